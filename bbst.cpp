@@ -1,950 +1,7037 @@
-/**************************************************************************************************************
- * Author: sourav parmar
- *
- * Advanced data structure : treemap implementation using red black tree
- * *************************************************************************************************************
- * Features supported
- * Increase(theID, m):Increase the count of the event theID by m. IftheID is not present, insert it.
- * Reduce(theID, m):Decrease the count of theID by m. If theID’scount becomes less than or equal to 0,remove theID
- * Count(theID):Print the count of theID.
- * InRange(ID1, ID2):Print the total count for IDs between ID1 and ID2 inclusively
- * Next(theID):Print the ID and the count of the event with the lowest ID that is greater that theID
- * Previous(theID):Print the ID and the count of the event with the greatest key that is less that theID.
- * levelorder: Print the RB tree according to level
- * Running instruction: ./bbst <input_file>
- * command : input from command line:  command <param> .... eg increase 100 5
- **************************************************************************************************************/
-
-#include<iostream>
-#include<string>
-#include <fstream>
-#include<sstream>
-#include<queue>
-using namespace::std;
-/**************************************************************************************************************
- * A red-black tree is a binary search tree where each node has a color attribute, the value of which is either
- * red or black
- *
- *  requirements of a valid  red-black tree:
- *  1) The root is black.
- *  2) All leaves are black.
- *  3) Both children of each red node are black.
- *  4) The paths from each leaf up to the root each contain the same
- *     number of black nodes.
- *
- **************************************************************************************************************/
-#define RED 0
-#define BLACK 1
-struct RBNode{
-    int mkey;
-    int mvalue;
-    RBNode* parent;
-    RBNode* left;
-    RBNode* right;
-    RBNode* successor;
-    bool mcolor; // 0 RED 1 BLACK
-    RBNode(int key, int value, bool color):mkey(key)
-      ,mvalue(value)
-      ,mcolor(color)
-      ,parent(NULL)
-      ,left(NULL)
-      ,right(NULL)
-      ,successor(NULL)
-    {}
-    ~RBNode(){}
-};
-/****************************************************************************************************************
- * senitel nil node is used to represent black null nodes
- * parent of root points to senitel nil node hence avoid check for NULL pointers
- *
- * RB function:
- * buildtree : creates a BST from the sorted input.
- * colortee: converts created BST to redblack with odd level colored as RED (root is at level 0)
- * insert: inserts a node in RB BST
- * insertFixup: maintains RB invariants during insertion
- * deletenode: deletes a node from RB BST.
- * deleteFixup: maintains RB invariants during delete
- *
- * map function:
- * increase: increase the value associated with key, if key is not found insert it in RB BST
- * decrease:  reduce the value associated with key, if value decreased to 0 delete that key from RB BST
- * cout: count of value associated with key.
- * inrange: sum of count of values between given key ranges
- * next:Print the key and the value of the event with the lowest key  that is greater than given key
- * previous:Print the key and the value of the event with the greatest key that is less than given key
- *
- ***************************************************************************************************************/
-class treemap{
-    RBNode *root;
-    RBNode *nil;
-    void rotateleft(RBNode* &, RBNode*&);
-    void rotateright(RBNode*&, RBNode* &);
-    void insertFixup(RBNode* &, RBNode*&);
-    void deleteFixup(RBNode*&, RBNode* &);
-    RBNode* inserthelper(RBNode*,RBNode*);
-    RBNode* successor(RBNode* , RBNode* );
-    RBNode* predecessor(RBNode* , RBNode* );
-    RBNode* buildhelper(vector<pair<int,int> >&, int start, int end,int level, int &maxlevel);
-    void inrangehelper(RBNode*, int , int, int&);
-    void levelorder(RBNode*);
-    RBNode* findmin(RBNode*);
-    RBNode* findmax(RBNode*);
-public:
-    int buildtree(vector<pair<int,int> >&);
-    void increase(int key, int value);
-    void decrease(int key, int value);
-    void count(int key);
-    void inrange(int key1, int key2);
-    void next(int key);
-    void previous(int key);
-    void insert(int key, int value);
-    bool findvalidnode(int key, RBNode *root, RBNode* &prev, RBNode* &curr,bool );
-    void deletenode(RBNode* &todelete, RBNode* &root, int key);
-    void inorder(RBNode*,RBNode*&,int , int maxlevel);
-    void deletetree(RBNode* );
-    void colortree(int maxlevel);
-    RBNode* searchkey(RBNode* root, int key);
-    void levelorderprint();
-    treemap ():root(NULL){
-        nil = new RBNode(-1,-1,BLACK);// senitel nil node
-        nil->parent=nil;
-        nil->left= nil;
-        nil->right=nil;
-    };
-    inline RBNode* getroot(){return root;}
-    inline RBNode* rbnil(){return nil;}
-    ~treemap()
-    {
-        deletetree(this->root);
-        delete this->nil;
-    }
-};
-/************************************************************************************************************
- * Destroy tree on exit: called from treemap destructor
- ************************************************************************************************************/
-void treemap::deletetree( RBNode *root )
-{
-    if ( root != rbnil() )
-    {
-        deletetree( root->left );
-        deletetree( root->right );
-        delete( root );
-    }
-}
-
-/****************************************************************************************************************
- * Helper funtion for Red black tree insert.
- * This funtion insert a node in it's appropriate postion in a BST
- * Inserted node is colored red
- * **************************************************************************************************************/
-RBNode* treemap::inserthelper(RBNode* root, RBNode* curr) // Binary search tree insert
-{
-    if(root == NULL || root == rbnil())
-        return curr;
-    if(root->mkey > curr->mkey)
-    {
-        root->left = inserthelper(root->left,curr);
-        root->left->parent = root;
-    }
-    else if(root->mkey < curr->mkey) // insert at right
-    {
-        root->right = inserthelper(root->right, curr);
-        root->right->parent = root;
-    }
-    else // value equal just increment count
-        root->mvalue += curr->mvalue;
-    return root;
-}
-/***********************************************************************************************
- * rotate left: Rotates the treenode in anti clockwise direction with respect to current node
-************************************************************************************************/
-void treemap::rotateleft(RBNode*& root, RBNode*& curr)
-{
-    RBNode* currright = curr->right;
-    curr->right = currright->left;
-    if(curr->right != rbnil())curr->right->parent = curr;
-    currright->parent = curr->parent;
-    if(curr->parent == rbnil()) // curr is root node
-        root = currright;
-    else if(curr->parent->left == curr)// current is left child
-        curr->parent->left = currright;
-    else
-        curr->parent->right = currright; // curr is right child, curr parent right now point to currright
-    currright->left = curr;
-    curr->parent = currright;
-
-}
-
-/***********************************************************************************************
- * rotate right: Rotates the treenode in  clockwise direction with respect to current node
-************************************************************************************************/
-void treemap::rotateright(RBNode*& root, RBNode*& curr)
-{
-    RBNode* currleft = curr->left;
-    curr->left = currleft->right;
-    if(curr->left != rbnil())curr->left->parent = curr;
-    currleft->parent = curr->parent;
-    if(curr->parent == rbnil()) // curr is root node
-        root = currleft;
-    else if(curr->parent->left == curr)// current is left child
-        curr->parent->left = currleft;
-    else
-        curr->parent->right = currleft; // curr is right child, curr parent right now point to currleft
-    currleft->right = curr;
-    curr->parent = currleft;
-
-}
-/* **********************************************************************************************************************
-*          THis function restores RB tree invarients during insert
-*           case 1:uncle of curr is red
-*           case 2:uncle of curr is black and curr is right child of parent: simply leftrotate and transform to case 3
-*           case 3:uncle of curr is black and curr is left child of parent:
-                    change color of parent as black
-                    change color of grandparent as red
-                    rightrotate along grandparent
-*************************************************************************************************************************/
-void treemap::insertFixup(RBNode*& root, RBNode*& curr)
-{
-    while(curr != root &&  curr->parent->mcolor == RED) // loop till parent is black
-    {
-        RBNode* parent = curr->parent;
-        RBNode* g_parent = parent->parent;
-        RBNode* uncle = NULL;
-        if(g_parent->left == parent) // parent is left child
-        {
-            uncle = g_parent->right;
-            //case 1 uncle of curr is red
-            if(uncle->mcolor == RED)// no need for null check as senitel node is nil which is always black
-            {
-                g_parent->mcolor = RED;
-                uncle->mcolor = BLACK;
-                parent->mcolor = BLACK;
-                curr = g_parent;
-            }
-            else
-            {
-                if(curr == parent->right) // case 2:Transform to case 3
-                {
-                    rotateleft(root,parent);
-                    curr = parent; // no need to adjust parent field as it is already done in rotateleft
-                    parent = curr->parent;
-                }
-                parent->mcolor = BLACK;
-                g_parent->mcolor = RED;
-                rotateright(root, g_parent);
-            }
-        }
-        else{ // symmetic case parent is right child
-            uncle  = g_parent->left;
-            if(uncle && uncle->mcolor == RED)
-            {
-                g_parent->mcolor = RED;
-                uncle->mcolor = BLACK;
-                parent->mcolor = BLACK;
-                curr = g_parent;
-            }
-            else
-            {
-                if(curr == parent->left) // case 2:Transform to case 3
-                {
-                    rotateright(root,parent);
-                    curr = parent; // no need to adjust parent field as it is already done in rotateleft
-                    parent = curr->parent;
-                }
-                parent->mcolor = BLACK;
-                g_parent->mcolor = RED;
-                rotateleft(root, g_parent); // parent is now black loop invarient are satisfied
-            }
-        }
-    }
-    root->mcolor = BLACK; // property 2 of RBT i.e root shall be black.
-}
-/************************************************************************************************************
- * This function inserts a node in RBTree
- * Firstly, call inserthelper to isert node in appropriate postion in BST
- * secondly,calls insertFixup to resolve violation of RB tree invariants
- * **********************************************************************************************************/
-void treemap::insert(int key, int value)
-{
-    RBNode * node = new RBNode(key, value,RED); // inserted node red in color
-    node->left = rbnil(); // left  points to senitel nil
-    node->right= rbnil(); // right  points to senitel nil
-    root = inserthelper(root,node);
-    root->parent = rbnil();// parent of root points to senitel nil
-    insertFixup(root, node);
-}
-/*************************************************************************************************************
- * Helper function to compare two string independent of case
- * Used to parse commands
- * ***********************************************************************************************************/
-
-bool strequal(const string & first ,const string& second)
-{
-    unsigned int len= first.size();
-    if(len != second.size() )
-        return false;
-    for(int i = 0 ; i <len;++i)
-    {
-        if(tolower(first[i])!= tolower(second[i]))
-            return false;
-    }
-    return true;
-}
-/***********************************************************************************************************
-  * Utility funtion :color last level node as RED if it is not root
-  **********************************************************************************************************/
-void treemap::inorder(RBNode * root,RBNode*& prev,int level, int maxlevel)
-{
-    if(root == NULL || root == rbnil()) return;
-    inorder(root->left,prev,level+1, maxlevel);
-    //cout<< "key "<<root->mkey <<" color "<<root->mcolor<<endl;
-    if(prev) prev->successor = root;
-    prev = root;
-    if(level && level == maxlevel) root->mcolor = RED;// color last level as RED, if maxlevel is 0 don't recolor
-    inorder(root->right,prev,level+1 ,maxlevel);
-}
-/***********************************************************************************************************
-  *convert created BST to RB BST: calls inorder to color
-  **********************************************************************************************************/
-void treemap::colortree(int maxlevel)
-{
-    RBNode* prev = NULL;
-    inorder(root,prev,0, maxlevel);
-}
-/*****************************************************************************************************************
- * Utility function for Debug: level order travesal of a RBTree
- * **************************************************************************************************************/
-void treemap::levelorder(RBNode* root)
-{
-    if(root == NULL ||  root == rbnil())
-        return;
-    queue<RBNode*>q;
-    q.push(root);
-    while(1)
-    {
-        int size = q.size();
-        if(size == 0)
-            break;
-        RBNode* temp = NULL;
-        while(size)
-        {
-            temp = q.front();
-            q.pop();
-            cout<<" key " <<temp->mkey<<" color "<<temp->mcolor<<" parent ";
-            if(temp->parent) cout<<temp->parent->mkey<<" ";
-            cout<<endl;
-            if(temp->left !=rbnil())q.push(temp->left);
-            if(temp->right!=rbnil())q.push(temp->right);
-            size--;
-        }
-        cout<<"-----------Next Level-----------"<<endl;
-    }
-}
-
-void treemap::levelorderprint()
-{
-    levelorder(root);
-}
-/******************************************************************************************************
- * Utility function: Returns Node if the search key matches any node in RB BST else returns NULL
- ******************************************************************************************************/
-RBNode* treemap::searchkey(RBNode* root, int key)
-{
-    if(root == NULL || root->mkey == key)
-        return root;
-    if(root == rbnil()) return NULL;
-    if(root->mkey > key ) return searchkey(root->left,key );
-    if(root->mkey < key ) return searchkey(root->right,key);
-}
-/******************************************************************************************************
- * Utility function for next and previous methods:
- * sets curr node which is used by next and previous method
- * curr equals root if root key matches search key
- * if key is in range (prev.key,root,key) then
- *       curr equals previous observed inorder node if findsucc flag is true
- *       curr equals root if findsucc flag is true
- *
- * findsucc : used to differentiate call from next or previos method
- ******************************************************************************************************/
-bool treemap::findvalidnode(int key, RBNode *root, RBNode* &prev, RBNode* &curr, bool findsucc)
-{
-    if(root == NULL || root == rbnil())
-    {
-        return false;
-    }
-    if(root->mkey == key)
-    {
-        curr = root; // if node is found in tree update curr as root and return
-        return true;
-    }
-    if(key < root->mkey && findvalidnode(key, root->left,prev,curr ,findsucc))
-        return true; // early exit if validnode found
-    if((prev && (prev->mkey < key && root->mkey > key)))
-    {
-        if(findsucc)
-            curr = prev; // if finding next update curr as previous observed inoder node
-        else
-            curr = root; // if finding previous update curr as root
-        //cout<<prev->mkey<< " "<<key<<" "<<root->mkey<<" "<<endl;
-        return true;
-    }
-    prev = root;
-
-    if(key > root->mkey) findvalidnode(key, root->right,prev,curr,findsucc);
-}
-/******************************************************************************************************
- * Utility function: Returns minimum node in BST
- ******************************************************************************************************/
-RBNode* treemap::findmin(RBNode* root)
-{
-    while(root->left!=rbnil())
-        root = root->left;
-    return root;
-}
-/******************************************************************************************************
- * Utility function: Returns maximum node in BST
- ******************************************************************************************************/
-RBNode* treemap::findmax(RBNode* root)
-{
-    while(root->right!=rbnil())
-        root = root->right;
-    return root;
-}
-/******************************************************************************************************
- * Utility function: Returns inorder succesor of a node in BST
- * if rightsubtee exist, inorder successor is minimum value on right subtree
- * else inorder successor the parentof node when current node is leftchild of its parent
- ******************************************************************************************************/
-RBNode* treemap::successor(RBNode* curr, RBNode* root)
-{
-    if(curr->right != rbnil())
-    {
-        curr = curr->right;
-        while(curr->left != rbnil())
-        {
-            curr = curr->left;
-        }
-        return curr;
-    }
-    RBNode* p_curr = curr->parent;
-    while(p_curr!=rbnil() && curr == p_curr->right)
-    {
-        curr = p_curr;
-        p_curr = curr->parent;
-    }
-    return p_curr;
-}
-/******************************************************************************************************
- * Utility function: Returns inorder predecessor  of a node in BST
- ******************************************************************************************************/
-RBNode* treemap::predecessor(RBNode* curr, RBNode* root)
-{
-    if(curr->left !=rbnil())
-    {
-        curr = curr->left;
-        while(curr->right !=rbnil())
-        {
-            curr = curr->right;
-        }
-        return curr;
-    }
-    RBNode* p_curr = curr->parent;
-    while(p_curr!=rbnil() && curr != p_curr->right)
-    {
-        curr = p_curr;
-        p_curr = curr->parent;
-    }
-    return p_curr;
-}
-/****************************************************************************************************************
- * Maintains RB invariant while delete
- * case A when current node is left child of parent
- * case 1:curr node sibling is red: leftrotate along parent and change sibling color to black and parent to red
- * case 2: curr node sibling is black and both child of sibling black : change color of sibling to red and curr
- *         points to parent
- * case 3: curr node sibling is black, sibling left child is red and sibling right child is black:
- *         swtich color of sibling and it's left child and rotateright along sibling, new sibling is now leftchild
- *         sibling
- * case 4: curr node sibling is black, sibling right child is red
- *         color sibling as color of parent
- *         color parent of curr as black
- *         color sibling right child as black
- *         leftrotate along parent
- *         since property restored in this set curr as root to terminate loop
- *
- * case B when current node is right child of its parent
- *        this is symmetric to case A subscases.
- ****************************************************************************************************************/
-void treemap::deleteFixup(RBNode*& root,RBNode*& curr)
-{
-    while( curr!= root &&  curr->mcolor == BLACK)
-    {
-        RBNode* sibling = NULL;
-        if(curr == curr->parent->left)
-        {
-            sibling = curr->parent->right;
-            if(sibling->mcolor == RED) // case 1
-            {
-                //cout<<"case 1"<<endl;
-                sibling->mcolor = BLACK;
-                curr->parent->mcolor = RED;
-                rotateleft(root,curr->parent);
-                sibling = curr->parent->right;
-            }
-            if(sibling->left->mcolor == BLACK && sibling->right->mcolor == BLACK)//case 2
-            {
-                //cout<<"case 2"<<endl;
-                sibling->mcolor = RED;
-                curr = curr->parent;
-                //cout<<"curr after case 2 "<<curr->mkey << " "<<curr->parent->mkey<<endl;
-            }
-            else
-            {
-                //cout<<"case 3"<<endl;
-                if(sibling->right->mcolor == BLACK)//case 3
-                {
-                    sibling->left->mcolor = BLACK;
-                    sibling->mcolor = RED;
-                    rotateright(root,sibling);
-                    sibling = curr->parent->right;
-                }
-                //cout<<"case 4"<<endl;
-                sibling->mcolor = curr->parent->mcolor;//case 4
-                curr->parent->mcolor = BLACK;
-                sibling->right->mcolor = BLACK;
-                rotateleft(root,curr->parent);
-                curr = root;
-            }
-        }
-        else // symmetric case if current is right child of its parent, symmetric to left case
-        {
-            sibling = curr->parent->left;
-            if(sibling->mcolor == RED)
-            {
-                //cout<<"case 5"<<endl;
-                sibling->mcolor = BLACK;
-                curr->parent->mcolor = RED;
-                rotateright(root,curr->parent);
-                sibling = curr->parent->left;
-            }
-            if(sibling->right->mcolor == BLACK && sibling->left->mcolor == BLACK)
-            {
-                //cout<<"case 6"<<endl;
-                sibling->mcolor = RED;
-                curr = curr->parent;
-            }
-            else
-            {
-                if(sibling->left->mcolor == BLACK)
-                {
-                    // cout<<"case 7"<<endl;
-                    sibling->right->mcolor = BLACK;
-                    sibling->mcolor = RED;
-                    rotateleft(root,sibling);
-                    sibling = curr->parent->left;
-                }
-                // cout<<"case 8"<<endl;
-                sibling->mcolor = curr->parent->mcolor;
-                curr->parent->mcolor = BLACK;
-                sibling->left->mcolor = BLACK;
-                rotateright(root,curr->parent);
-                curr = root;
-            }
-        }
-    }
-    //cout<<" rootafter fixup  "<<root->mkey<<endl;
-    curr->mcolor = BLACK;
-}
-/*********************************************************************************************************
- * delete node from RB BST
- * if deleted node is red no heigt changes
- * if delted node is BLACK calls deleteFixup to preserve RB invariants as black height is decreased after
- *          deletion
- *******************************************************************************************************/
-void treemap::deletenode(RBNode* &todelete, RBNode* &root, int key)
-{
-    if(todelete == NULL)
-    {
-        // cout<<"Error: Node not found"<<endl;
-        return;
-    }
-    // cout<<" deletenode enter"<<endl;
-    RBNode* del = rbnil();
-    //cout<<"todelete "<<todelete->mkey<< "left "<<todelete->left->mkey<<"right "<<todelete->right->mkey<<endl;
-    if(todelete->left == rbnil() || todelete->right == rbnil())
-        del = todelete;
-    else
-        del = successor(todelete, root);
-    //cout<<"todelete "<<todelete->mkey<< "left "<<todelete->left->mkey<<"right "<<todelete->right->mkey<<" del "<<del->mkey<<endl;
-    RBNode* child = del->left == rbnil()?del->right : del->left;
-    child->parent = del->parent;
-    if(del->parent == rbnil()) // node to be deleted is root
-        root = child;
-    //attach child at appropriate postion
-    if(del->parent->left == del)
-        del->parent->left = child;
-    else
-        del->parent->right = child;
-    //cout<<"before fixup"<<endl;
-    if(todelete != del)
-    {
-        todelete->mkey = del->mkey;
-        todelete->mvalue = del->mvalue;
-    }
-    if(del->mcolor == BLACK) // call fixup only when deleted node is black as it will violate black node count invarient
-    {
-        //cout<<"deleteFixup call"<< child->mkey<< " "<<endl;
-        deleteFixup(root,child);
-    }
-    delete del;
-}
-
-/*********************************************************************************************************************
- * Utility function: decrease count associated with a key
- * if count drops to zero calls deltenode procedure to remove node from RB BST
- * Prints updated count of node with key
- *********************************************************************************************************************/
-void treemap:: decrease(int key, int value)
-{
-    RBNode* todecrease = searchkey(root,key);
-    if(todecrease == NULL)// no need to handle for rbnil() as search will return null for nil node
-    {
-        cout<<"0"<<endl;
-        return;
-    }
-    todecrease->mvalue -= value;
-    if( todecrease->mvalue <= 0)
-    {
-        deletenode(todecrease, root, key);
-        cout<<"0"<<endl;
-    }
-    else
-        cout<< todecrease->mvalue<<endl;
-}
-
-/*********************************************************************************************************************
- * Utility function: Increase count associated with a key
- * if key not found calls insert procedure to insert node into RB BST
- * Prints updated count of node with key
- *********************************************************************************************************************/
-void treemap::increase(int key, int value){
-    RBNode* toincrease = searchkey(root,key);
-    if(toincrease == NULL) // no need to handle for rbnil() as search will return null for nil node
-    {
-        insert(key, value);
-        cout<<value<<endl;
-    }
-    else
-    {
-        toincrease->mvalue += value;
-        cout<<toincrease->mvalue<<endl;
-    }
-}
-/*********************************************************************************************************************
- * Utility function: Print count associated with a key
- * when key not found prints 0
- *********************************************************************************************************************/
-void treemap::count(int key)
-{
-    RBNode* curr = searchkey(root,key);
-    if(curr)
-        cout<< curr->mvalue <<endl;
-    else
-        cout<<"0"<<endl;
-}
-/*********************************************************************************************************************
- * Utility function: print  the lowest key that is greater than search key and associated count.
- * if none exist print " 0 0"
- *********************************************************************************************************************/
-void treemap::next(int key)
-{
-    RBNode* minimum = findmin(root);
-    if(key < minimum->mkey) // if key is less than minimum of tree the minimum key is succesor
-    {
-        cout<<minimum->mkey<<" "<<minimum->mvalue<<endl;
-        return;
-    }
-    RBNode* curr = NULL;
-    RBNode* prev = NULL;
-
-    findvalidnode(key, root, prev , curr,true);
-    RBNode* succ = NULL;
-    if(curr) succ = successor(curr,root); // find inorder successor
-    if(succ && succ!=rbnil()) cout<<succ->mkey<<" "<<succ->mvalue<<endl;
-    else
-        cout<<"0 0"<<endl;
-}
-/*********************************************************************************************************************
- * Utility function: print  the greatest key that is smaller than search key and associated count.
- * if none exist print " 0 0"
- *********************************************************************************************************************/
-void treemap::previous(int key)
-{
-    RBNode* maximum = findmax(root);
-    if(key > maximum->mkey)// if key is greater than maximum of tree the maximum key is predecessor
-    {
-        cout<<maximum->mkey<<" "<<maximum->mvalue<<endl;
-        return;
-    }
-    RBNode* curr = NULL;
-    RBNode* prev = NULL;
-    findvalidnode(key, root, prev , curr,false);
-    RBNode* pre = NULL;
-    if(curr) pre = predecessor(curr,root);// find inorder predecessor
-    if(pre && pre!=rbnil()) cout<<pre->mkey<<" "<<pre->mvalue<<endl;
-    else
-        cout<<"0 0"<<endl;
-}
-/*********************************************************************************************************************
- * Utility function: compute sum of count within given key ranges [key1,key2].
- *********************************************************************************************************************/
-void treemap::inrangehelper(RBNode* root, int key1, int key2,int& count)
-{
-    if(root == NULL || root == rbnil())
-        return;
-    if(key1 < root->mkey)
-        inrangehelper(root->left, key1,key2, count);
-    if((root->mkey >= key1) && (root->mkey <= key2))
-    {
-       // cout<<root->mkey<<" "<<root->mvalue<<endl;
-        count += root->mvalue; // if node value is within given range update count
-    }
-    if(key2 > root->mkey)
-        inrangehelper(root->right,key1,key2, count);
-}
-/*********************************************************************************************************************
- * Utility function: print  the sum of count within given key ranges [key1,key2].
- * calls inrangehelperto find sum
- *********************************************************************************************************************/
-void treemap::inrange(int key1, int key2)
-{
-    if(key2 <key1)
-    {
-       cout<<"Error! key1 shall be less than key2 "<<endl;
-       return;
-    }
-    int count = 0 ;
-    inrangehelper(root, key1, key2,count);
-    cout<<count<<endl;
-}
-/*********************************************************************************************************************
- * function: Build BST from input vector.
- * senitel nil is used for NULL
- *********************************************************************************************************************/
-RBNode* treemap::buildhelper(vector<pair<int,int> > &inp,  int begin, int end ,int level , int &maxlevel)
-{
-    if(begin > end) return rbnil();
-    int mid = begin+ (end - begin)/2;
-    RBNode* newnode = new RBNode(inp[mid].first, inp[mid].second,BLACK);//make tree  even nodes black
-    maxlevel = max(level,maxlevel);
-    newnode->left = buildhelper(inp,begin,mid-1,level+1, maxlevel);
-    if(newnode->left) newnode->left->parent = newnode;
-    newnode->right = buildhelper(inp, mid+1, end,level+1, maxlevel);
-    if(newnode->right) newnode->right->parent = newnode;
-    return newnode;
-}
-
-int treemap::buildtree(vector<pair<int,int> > &inp)
-{
-    int size = inp.size();
-    int maxlevel = 0 ;
-    root = buildhelper(inp,0,size-1,0, maxlevel);
-    root->parent = rbnil();// root parent is senitel
-    return maxlevel;
-}
-bool validate(string command)
-{
-    for(int i = 0 ; i <command.size();++i)
-    {
-        if(command[i] == ' ')
-            continue;
-        if(tolower(command[i]) <'a' || tolower(command[i]) >'z')
-            return false;
-    }
-    return true;
-}
-
-int main(int argc, char* argv[]){
-    treemap mytree;
-    long nelem; //first param of line
-    string temp;
-    ifstream instream;
-    instream.exceptions ( ifstream::failbit | ifstream::badbit );
-    cout<<" input file " << argv[1]<<endl;
-    {
-        vector<pair<int,int> > treevec;
-        try
-        {
-            instream.open(argv[1]);
-            getline(instream,temp);
-            stringstream s_nelem(temp);
-            s_nelem >> nelem;
-            string key, value;
-            int ikey, ivalue;
-            cout<<" nelem "<<nelem<<endl;
-            while(getline(instream, key, ' '))
-            {
-                getline(instream, value);
-                istringstream s_key(key);
-                istringstream s_value(value);
-                s_key >> ikey;
-                s_value>> ivalue;
-                treevec.push_back(make_pair(ikey,ivalue));
-                //mytree.insert(ikey, ivalue);// insert key value pair in treemap
-            }
-        }
-        catch (ifstream::failure e) {
-            if(!instream.eof())
-                std::cout << "Exception opening/reading file ! Wrong file name\n";
-        }
-
-        std::cout.flush();
-        instream.close();
-        //cout<<"before build "<<endl;
-        int maxlevel = mytree.buildtree(treevec);
-        cout<<"maxlevel "<< maxlevel<<endl;
-        mytree.colortree(maxlevel);
-    }
-    cout<<" Tree built "<<endl;
-    std::cout<<" ______________________________________________________________"<<std::endl;
-    std::cout<<"| map created, enter commands in specified format              |"<<std::endl;
-    std::cout<<"|______________________________________________________________|"<<std::endl;
-    std::cout<<"|* command: increase  | format increase <id_INT> <count_INT>   |"<<std::endl;
-    std::cout<<"|* command: reduce    | format reduce   <id_INT> <count_INT>   |"<<std::endl;
-    std::cout<<"|* command: count     | format count    <id_INT>               |"<<std::endl;
-    std::cout<<"|* command: inRange   | format inrange  <id_INT> <id_INT>      |"<<std::endl;
-    std::cout<<"|* command: next      | format next     <id_INT>               |"<<std::endl;
-    std::cout<<"|* command: previous  | format previous <id_INT>               |"<<std::endl;
-    std::cout<<"|* command: levelorder| format levelorder                      |"<<std::endl;
-    std::cout<<"|* command: quit      | format quit                            |"<<std::endl;
-    std::cout<<"|______________________________________________________________|"<<std::endl;
-    while(1)
-    {   string inp;
-        //istringstream instream(std::cin);
-        getline(std::cin, inp);
-
-        stringstream s_command(inp);
-        string command;
-        s_command>> command;
-        if(validate(command) == false)
-        {
-            cout<<" Error ! command should be string"<<endl;
-            continue;
-        }
-        if(strequal(command, "quit"))
-            break; // quit comand issue exit from loop
-
-        int param1;
-        int param2;
-        if(strequal(command,"increase"))
-        {
-            s_command >> param1;
-            if(s_command.fail()) // invalid input, expected is int
-            {
-                s_command.clear();
-                cout<<"Error ! Param1 should be a integer value "<<endl;
-                continue;// since stream is reset at every iteration no need to ignore
-            }
-            s_command >> param2;
-            if(s_command.fail()) // invalid input, expected is int
-            {
-                s_command.clear();
-                cout<<"Error ! Param 2 should be a integer value "<<endl;
-                continue;// since stream is reset at every iteration no need to ignore
-            }
-            if(param2 <= 0) { cout<<"Not a valid input param 2 try again with value greater than 0"<<endl;continue;}
-            mytree.increase(param1,param2);
-        }
-        else if(strequal(command,"reduce"))
-        {
-            s_command >> param1;
-            if(s_command.fail()) // invalid input, expected is int
-            {
-                s_command.clear();
-                cout<<"Error ! Param1 should be a integer value "<<endl;
-                continue;// since stream is reset at every iteration no need to ignore
-            }
-            s_command >> param2;
-            if(s_command.fail()) // invalid input, expected is int
-            {
-                s_command.clear();
-                cout<<"Error ! Param 2 should be a integer value "<<endl;
-                continue;// since stream is reset at every iteration no need to ignore
-            }
-
-            mytree.decrease(param1,param2);
-        }
-        else if(strequal(command ,"count"))
-        {
-            s_command >> param1;
-            if(s_command.fail()) // invalid input, expected is int
-            {
-                s_command.clear();
-                cout<<"Error ! Param1 should be a integer value "<<endl;
-                continue;// since stream is reset at every iteration no need to ignore
-            }
-            mytree.count(param1);
-        }
-        else if(strequal(command,"next"))
-        {
-            s_command >> param1;
-            if(s_command.fail()) // invalid input, expected is int
-            {
-                s_command.clear();
-                cout<<"Error ! Param1 should be a integer value "<<endl;
-                continue;// since stream is reset at every iteration no need to ignore
-            }
-            mytree.next(param1);
-        }
-        else if(strequal(command,"previous"))
-        {
-            s_command >> param1;
-            if(s_command.fail()) // invalid input, expected is int
-            {
-                s_command.clear();
-                cout<<"Error ! Param1 should be a integer value "<<endl;
-                continue;// since stream is reset at every iteration no need to ignore
-            }
-            mytree.previous(param1);
-        }
-        else if(strequal(command,"inrange"))
-        {
-            s_command >> param1;
-            if(s_command.fail()) // invalid input, expected is int
-            {
-                s_command.clear();
-                cout<<"Error ! Param1 should be a integer value "<<endl;
-                continue;// since stream is reset at every iteration no need to ignore
-            }
-            s_command >> param2;
-            if(s_command.fail()) // invalid input, expected is int
-            {
-                s_command.clear();
-                cout<<"Error !Param 2 should be a integer value "<<endl;
-                continue;// since stream is reset at every iteration no need to ignore
-            }
-            mytree.inrange(param1,param2);
-        }
-        else if(strequal(command,"levelorder"))
-        {
-            mytree.levelorderprint();
-        }
-        else
-        {
-            std::cout<<"Error ! Wrong command or command format | enter commands in following format"<<endl;
-            std::cout<<" ______________________________________________________________"<<std::endl;
-            std::cout<<"| map created, enter commands in specified format              |"<<std::endl;
-            std::cout<<"|______________________________________________________________|"<<std::endl;
-            std::cout<<"|* command: increase  | format increase <id_INT> <count_INT>   |"<<std::endl;
-            std::cout<<"|* command: reduce    | format reduce   <id_INT> <count_INT>   |"<<std::endl;
-            std::cout<<"|* command: count     | format count    <id_INT>               |"<<std::endl;
-            std::cout<<"|* command: inRange   | format inrange  <id_INT> <id_INT>      |"<<std::endl;
-            std::cout<<"|* command: next      | format next     <id_INT>               |"<<std::endl;
-            std::cout<<"|* command: previous  | format previous <id_INT>               |"<<std::endl;
-            std::cout<<"|* command: levelorder| format levelorder                      |"<<std::endl;
-            std::cout<<"|* command: quit      | format quit                            |"<<std::endl;
-            std::cout<<"|______________________________________________________________|"<<std::endl;
-        }
-    }
-    return 0;
-}
+/**************************************************************************************************************
+ * Author: sourav parmar
+ *
+ * Advanced data structure : treemap implementation using red black tree
+ * *************************************************************************************************************
+ * Features supported
+ * Increase(theID, m):Increase the count of the event theID by m. IftheID is not present, insert it.
+ * Reduce(theID, m):Decrease the count of theID by m. If theID’scount becomes less than or equal to 0,remove theID
+ * Count(theID):Print the count of theID.
+ * InRange(ID1, ID2):Print the total count for IDs between ID1 and ID2 inclusively
+ * Next(theID):Print the ID and the count of the event with the lowest ID that is greater that theID
+ * Previous(theID):Print the ID and the count of the event with the greatest key that is less that theID.
+ * TopK(k):Print ID and count of the k events with the highest counts, highest first, ties by lower ID.
+ * Tick(time):Move the clock of the time windowed engine (-window) to time, increase may carry the time as well.
+ * levelorder: Print the RB tree according to level
+ * poolstats: Print node pool allocation stats and bytes per event
+ * Running instruction: ./bbst [-compact|-btree|-concurrent|-shards N] [-binary [-commands file]] <input_file>
+ *        -compact: store the tree in compactmap (32 bit index links) instead of treemap
+ *        -btree: store events in bplustree (16 keys, one cache line of keys per node, chained leaves) instead of treemap
+ *        -concurrent: thread safe treemap with optimistic lock free reads (concurrentmap)
+ *        -shards N: N key range shards, each a treemap owned by a worker thread (shardedmap)
+ *        -window S [-buckets N]: counts of the last S seconds only, ring of N treemap buckets (windowmap), N must
+ *                                divide S, without -buckets N is the largest divisor of S up to 60
+ *        -cache N: treemap with an N slot hot key cache in front of searchkey
+ *        -static: read only Eytzinger layout with prefix sums (staticmap), the first increase/reduce turns it into a treemap
+ *        -binary: read binary command records (see binarycommand) from stdin, or from file given by -commands
+ * Encode text commands to binary records: ./bbst -encode < text_commands > binary_commands
+ * Benchmark: ./bbst -bench <name> [params], see runbenchmark
+ * command : input from command line:  command <param> .... eg increase 100 5
+ **************************************************************************************************************/
+
+#include<iostream>
+#include<string>
+#include <fstream>
+#include<sstream>
+#include<queue>
+#include<chrono>
+#include<random>
+#include<cstdlib>
+#include<vector>
+#include<algorithm>
+#include<new>
+#include<cstdint>
+#include<climits>
+#include<cmath>
+#include<atomic>
+#include<mutex>
+#include<thread>
+#include<condition_variable>
+#include<functional>
+#include<deque>
+#include<set>
+#include<cstdio>
+#include<cstring>
+#include<unistd.h>
+#include<fcntl.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<sys/resource.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include<immintrin.h>
+#endif
+using namespace::std;
+/**************************************************************************************************************
+ * A red-black tree is a binary search tree where each node has a color attribute, the value of which is either
+ * red or black
+ *
+ *  requirements of a valid  red-black tree:
+ *  1) The root is black.
+ *  2) All leaves are black.
+ *  3) Both children of each red node are black.
+ *  4) The paths from each leaf up to the root each contain the same
+ *     number of black nodes.
+ *
+ **************************************************************************************************************/
+#define RED 0
+#define BLACK 1
+/****************************************************************************************************************
+ * countsum: type of subtree sums for a count type, wide enough that no sum of a tree can overflow
+ * at most 2^31 nodes: counts up to 32 bits sum exactly in long long, 64 bit counts sum in 128 bits
+ ****************************************************************************************************************/
+template<class Count, bool wide = (sizeof(Count) > 4), bool issigned = numeric_limits<Count>::is_signed>
+struct countsum{
+    typedef long long type;
+};
+template<class Count> struct countsum<Count, true, true>{
+    typedef __int128 type;
+};
+template<class Count> struct countsum<Count, true, false>{
+    typedef unsigned __int128 type;
+};
+/****************************************************************************************************************
+ * addcount/subcount: count update saturating at the limits of Count instead of wrapping
+ ****************************************************************************************************************/
+template<class Count> inline Count addcount(Count count, Count delta)
+{
+    Count result;
+    if(__builtin_add_overflow(count, delta, &result))
+        return delta > 0 ? numeric_limits<Count>::max() : numeric_limits<Count>::min();
+    return result;
+}
+
+template<class Count> inline Count subcount(Count count, Count delta)
+{
+    Count result;
+    if(__builtin_sub_overflow(count, delta, &result))
+        return delta > 0 ? numeric_limits<Count>::min() : numeric_limits<Count>::max();
+    return result;
+}
+/****************************************************************************************************************
+ * hot path statistics, compiled in with -DBBST_STATS (make STATS=1) and printed by the stats command:
+ * per op counts and latency histograms of treemap, insertFixup/deleteFixup rotations, search depth, live nodes
+ * and slab bytes of the node pools
+ * every thread counts into its own treestats block (localstats), the owner is the only writer so an update is a
+ * relaxed store and no line is shared between threads; blocks stay on statslist after their thread exits
+ * ops are counted exactly, every STAT_SAMPLE-th op of a kind is timed in stattime ticks (rdtsc on x86, else
+ * steady_clock ns), bucket b counts timed ops that took [2^b, 2^(b+1)) ticks; printstats converts to ns
+ * without BBST_STATS the STATS_ hooks expand to nothing
+ ****************************************************************************************************************/
+enum {STAT_INCREASE, STAT_DECREASE, STAT_COUNT, STAT_INRANGE, STAT_NEXT, STAT_PREVIOUS, STAT_OPS};
+#ifdef BBST_STATS
+enum {STAT_BUCKETS = 40, STAT_SAMPLE = 16};
+struct alignas(64) treestats{
+    unsigned long long ops[STAT_OPS];
+    unsigned long long latencyticks[STAT_OPS]; // sum over the timed ops
+    unsigned long long latency[STAT_OPS][STAT_BUCKETS];
+    unsigned long long insertrotations;
+    unsigned long long deleterotations;
+    unsigned long long searches;    // root to leaf descents
+    unsigned long long searchdepth; // nodes visited by them
+    long long nodes;                // allocated - released by this thread, the sum over threads is the live count
+    long long bytes;                // slab bytes reserved - freed
+    treestats* nextstats;
+};
+static treestats* statslist = NULL;
+static mutex statsmutex;
+
+static inline treestats& localstats()
+{
+    static thread_local treestats* mine = NULL;
+    if(!mine)
+    {
+        mine = new treestats();
+        lock_guard<mutex> guard(statsmutex);
+        mine->nextstats = statslist;
+        statslist = mine;
+    }
+    return *mine;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static inline unsigned long long stattime(){return __rdtsc();}
+#else
+static inline unsigned long long stattime()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+/****************************************************************************************************************
+ * tickspernanosecond: stattime ticks against steady_clock over 20 ms, measured once
+ ****************************************************************************************************************/
+static double tickspernanosecond()
+{
+    static double rate = 0;
+    if(rate == 0)
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        unsigned long long ticks = stattime();
+        this_thread::sleep_for(chrono::milliseconds(20));
+        ticks = stattime() - ticks;
+        rate = ticks / chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+    }
+    return rate;
+}
+
+template<class T> static inline void statadd(T& field, long long delta)
+{
+    __atomic_store_n(&field, (T)(field + delta), __ATOMIC_RELAXED);
+}
+
+class optimer{
+    treestats& stats;
+    int op;
+    unsigned long long start; // 0: op not timed
+public:
+    optimer(int op):stats(localstats()),op(op),start(0)
+    {
+        statadd(stats.ops[op], 1);
+        if(stats.ops[op] % STAT_SAMPLE == 0) start = stattime();
+    }
+    ~optimer()
+    {
+        if(!start) return;
+        unsigned long long ticks = stattime() - start;
+        statadd(stats.latencyticks[op], ticks);
+        statadd(stats.latency[op][ticks > 1 ? min(63 - __builtin_clzll(ticks), (int)STAT_BUCKETS - 1) : 0], 1);
+    }
+};
+#define STATS_OP(op) optimer statstimer(op)
+#define STATS_ADD(field, delta) statadd(localstats().field, (long long)(delta))
+#define STATS_SEARCH(depth) do{treestats& stats = localstats(); statadd(stats.searches, 1); \
+                               statadd(stats.searchdepth, depth);}while(0)
+#else
+#define STATS_OP(op)
+#define STATS_ADD(field, delta)
+#define STATS_SEARCH(depth)
+#endif
+/****************************************************************************************************************
+ * basic_rbnode: tree node for Key keys and Count counts, RBNode is the int/int node of the bbst commands
+ * layout of RBNode is unchanged at 64 bytes, a 64 bit key/count node with its 128 bit msum is 80 bytes
+ ****************************************************************************************************************/
+template<class Key, class Count> struct basic_rbnode{
+    typedef Key keytype;
+    typedef Count counttype;
+    typedef typename countsum<Count>::type sumtype;
+    Key mkey;
+    Count mvalue;
+    basic_rbnode* parent;
+    basic_rbnode* left;
+    basic_rbnode* right;
+    basic_rbnode* successor;   // next node in key order, NULL for the maximum
+    basic_rbnode* predecessor; // previous node in key order, NULL for the minimum
+    bool mcolor; // 0 RED 1 BLACK, ahead of msum so a 16 byte aligned sumtype adds no tail padding
+    sumtype msum; // sum of mvalue over the subtree rooted at this node, nil keeps 0
+    basic_rbnode(Key key, Count value, bool color):mkey(key)
+      ,mvalue(value)
+      ,parent(NULL)
+      ,left(NULL)
+      ,right(NULL)
+      ,successor(NULL)
+      ,predecessor(NULL)
+      ,mcolor(color)
+      ,msum(value)
+    {}
+    ~basic_rbnode(){}
+};
+typedef basic_rbnode<int,int> RBNode;
+/****************************************************************************************************************
+ * nodepool: slab allocator for RBNode (basic_nodepool for any node type)
+ * nodes are carved from contiguous slabs, slab size doubles from SLABMIN up to SLABMAX nodes
+ * released nodes are pushed on an intrusive free list chained through parent and recycled by alloc
+ * all slabs are released in bulk by clear or on destruction, no per node delete is needed
+ ****************************************************************************************************************/
+template<class Node> class basic_nodepool{
+    static const size_t SLABMIN = 1024;
+    static const size_t SLABMAX = 65536;
+    vector<Node*> slabs;
+    Node* freelist;
+    size_t slabused;   // nodes carved from last slab
+    size_t slabsize;   // capacity of last slab
+    size_t reserved;   // nodes in all slabs
+    size_t live;
+    size_t peak;
+    size_t allocs;
+    size_t recycled;   // allocations served from free list
+    void addslab();
+public:
+    basic_nodepool():freelist(NULL),slabused(0),slabsize(0),reserved(0),live(0),peak(0),allocs(0),recycled(0){}
+    ~basic_nodepool(){clear();}
+    Node* alloc(typename Node::keytype key, typename Node::counttype value, bool color);
+    Node* allocblock(size_t n);
+    void release(Node*);
+    void clear();
+    void printstats();
+    inline double bytesperlive(){return live ? (double)reserved*sizeof(Node)/live : 0;}
+    inline size_t inuse(){return live;}
+};
+typedef basic_nodepool<RBNode> nodepool;
+template<class Node> const size_t basic_nodepool<Node>::SLABMIN;
+template<class Node> const size_t basic_nodepool<Node>::SLABMAX;
+
+template<class Node>
+void basic_nodepool<Node>::addslab()
+{
+    slabsize = slabsize ? min<size_t>(slabsize*2, SLABMAX) : SLABMIN;
+    slabs.push_back(static_cast<Node*>(::operator new(slabsize*sizeof(Node))));
+    reserved += slabsize;
+    STATS_ADD(bytes, slabsize*sizeof(Node));
+    slabused = 0;
+}
+
+template<class Node>
+Node* basic_nodepool<Node>::alloc(typename Node::keytype key, typename Node::counttype value, bool color)
+{
+    Node* mem = NULL;
+    if(freelist)
+    {
+        mem = freelist;
+        freelist = freelist->parent;
+        recycled++;
+    }
+    else
+    {
+        if(slabused == slabsize) addslab();
+        mem = slabs.back() + slabused++;
+    }
+    allocs++;
+    live++;
+    peak = max(peak, live);
+    STATS_ADD(nodes, 1);
+    return new(mem) Node(key, value, color);
+}
+
+/****************************************************************************************************************
+ * allocblock: n contiguous uninitialised nodes in a slab of their own, caller constructs them in place
+ ****************************************************************************************************************/
+template<class Node>
+Node* basic_nodepool<Node>::allocblock(size_t n)
+{
+    slabs.push_back(static_cast<Node*>(::operator new(n*sizeof(Node))));
+    slabsize = slabused = n; // next alloc starts a new slab
+    reserved += n;
+    allocs += n;
+    live += n;
+    peak = max(peak, live);
+    STATS_ADD(nodes, n);
+    STATS_ADD(bytes, n*sizeof(Node));
+    return slabs.back();
+}
+
+template<class Node>
+void basic_nodepool<Node>::release(Node* node)
+{
+    node->parent = freelist; // parent doubles as free list link
+    freelist = node;
+    live--;
+    STATS_ADD(nodes, -1);
+}
+
+template<class Node>
+void basic_nodepool<Node>::clear()
+{
+    STATS_ADD(nodes, -(long long)live);
+    STATS_ADD(bytes, -(long long)(reserved*sizeof(Node)));
+    for(size_t i = 0 ; i < slabs.size(); ++i)
+        ::operator delete(slabs[i]);
+    slabs.clear();
+    freelist = NULL;
+    slabused = slabsize = reserved = live = 0;
+}
+
+template<class Node>
+void basic_nodepool<Node>::printstats()
+{
+    cout<<"slabs "<<slabs.size()<<" reserved "<<reserved<<" live "<<live<<" peak "<<peak
+        <<" allocs "<<allocs<<" recycled "<<recycled<<" bytes "<<reserved*sizeof(Node)<<endl;
+}
+/****************************************************************************************************************
+ * taskpool: fixed set of worker threads running submitted tasks from one shared queue
+ * wait runs queued tasks on the calling thread too and returns once every submitted task has finished
+ ****************************************************************************************************************/
+class taskpool{
+    vector<thread> workers;
+    deque<function<void()> > tasks;
+    mutex lock;
+    condition_variable ready;   // task queued or stopping
+    condition_variable done;    // pending dropped to 0
+    size_t pending;             // queued or running tasks
+    bool stopping;
+    bool runone(unique_lock<mutex>& guard);
+    void work();
+public:
+    taskpool(size_t nthreads);
+    ~taskpool();
+    void submit(function<void()> task);
+    void wait();
+};
+
+taskpool::taskpool(size_t nthreads):pending(0),stopping(false)
+{
+    for(size_t i = 1 ; i < nthreads; ++i) // calling thread is the last worker, see wait
+        workers.push_back(thread(&taskpool::work, this));
+}
+
+taskpool::~taskpool()
+{
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    ready.notify_all();
+    for(size_t i = 0 ; i < workers.size(); ++i)
+        workers[i].join();
+}
+
+bool taskpool::runone(unique_lock<mutex>& guard)
+{
+    if(tasks.empty())
+        return false;
+    function<void()> task = tasks.front();
+    tasks.pop_front();
+    guard.unlock();
+    task();
+    guard.lock();
+    if(--pending == 0) done.notify_all();
+    return true;
+}
+
+void taskpool::work()
+{
+    unique_lock<mutex> guard(lock);
+    while(!stopping)
+        if(!runone(guard))
+            ready.wait(guard);
+}
+
+void taskpool::submit(function<void()> task)
+{
+    {
+        lock_guard<mutex> guard(lock);
+        tasks.push_back(task);
+        pending++;
+    }
+    ready.notify_one();
+}
+
+void taskpool::wait()
+{
+    unique_lock<mutex> guard(lock);
+    while(runone(guard));
+    while(pending) done.wait(guard);
+}
+/****************************************************************************************************************
+ * eventcounter: operations behind the bbst commands, implemented by every storage engine
+ * build: builds the engine from sorted (key, count) input, returns max level of the built tree
+ * increase/decrease return updated count of key (0 once key is removed), count returns 0 for absent keys
+ * next/previous return false when no such key exists
+ * exporttree appends every (key, count) in key order, used by the save command
+ * topk appends the k events with the highest counts in hotter order, the default ranks an exporttree
+ * tick: the clock of a time windowed engine moves to now (seconds), false when now is before the clock, other
+ * engines have no clock (see windowmap)
+ * increaseat: increase of an event that happened at time when, only called on timed engines
+ * timed: the engine has a clock, commands that carry a time are rejected by the others
+ * commit: make every applied increase/reduce durable, called before results are printed (see walmap)
+ * checkpoint: the state was just saved to or loaded from a snapshot with the given checksum
+ ****************************************************************************************************************/
+class eventcounter{
+public:
+    virtual ~eventcounter(){}
+    virtual int build(vector<pair<int,int> >&) = 0;
+    virtual int increase(int key, int value) = 0;
+    virtual int decrease(int key, int value) = 0;
+    virtual int count(int key) = 0;
+    virtual long long inrange(int key1, int key2) = 0;
+    virtual bool next(int key, pair<int,int>& found) = 0;
+    virtual bool previous(int key, pair<int,int>& found) = 0;
+    virtual void levelorderprint() = 0;
+    virtual void memoryreport() = 0;
+    virtual void exporttree(vector<pair<int,int> >& out);
+    virtual void topk(int k, vector<pair<int,int> >& out);
+    virtual bool tick(long long){return false;}
+    virtual int increaseat(int key, int value, long long){return increase(key, value);}
+    virtual bool timed(){return false;}
+    virtual void commit(){}
+    virtual void checkpoint(uint64_t){}
+};
+/****************************************************************************************************************
+ * exporttree: append all (key, count) pairs in key order, engines with direct access to their nodes override it
+ ****************************************************************************************************************/
+void eventcounter::exporttree(vector<pair<int,int> >& out)
+{
+    pair<int,int> found;
+    int first = count(INT_MIN); // next can not return the smallest possible key
+    if(first > 0) out.push_back(make_pair(INT_MIN, first));
+    for(int key = INT_MIN; next(key, found); key = found.first)
+        out.push_back(found);
+}
+/****************************************************************************************************************
+ * hotter: topk order of (key, count) pairs, higher count first, equal counts by lower key
+ ****************************************************************************************************************/
+struct hotter{
+    template<class Key, class Count> inline bool operator()(const pair<Key,Count>& a, const pair<Key,Count>& b) const
+    {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    }
+};
+/****************************************************************************************************************
+ * topk: full scan, every event is exported and the k hottest are selected with partial_sort, O(n log k)
+ ****************************************************************************************************************/
+void eventcounter::topk(int k, vector<pair<int,int> >& out)
+{
+    vector<pair<int,int> > events;
+    exporttree(events);
+    size_t n = min(events.size(), (size_t)max(k, 0));
+    partial_sort(events.begin(), events.begin() + n, events.end(), hotter());
+    out.insert(out.end(), events.begin(), events.begin() + n);
+}
+/****************************************************************************************************************
+ * batchop: one increase/reduce of a treemap::applyBatch batch, result receives the updated count
+ ****************************************************************************************************************/
+template<class Key, class Count> struct basic_batchop{
+    enum {INCREASE, REDUCE};
+    int type;
+    Key key;
+    Count value;
+    Count result;
+};
+typedef basic_batchop<int,int> batchop;
+/****************************************************************************************************************
+ * counterbase: base class of basic_treemap, the int/int treemap is an eventcounter engine, other key and count
+ * types are used directly through the same member functions
+ ****************************************************************************************************************/
+struct plaincounter{};
+template<class Key, class Count> struct counterbase{
+    typedef plaincounter type;
+};
+template<> struct counterbase<int,int>{
+    typedef eventcounter type;
+};
+/****************************************************************************************************************
+ * senitel nil node is used to represent black null nodes
+ * parent of root points to senitel nil node hence avoid check for NULL pointers
+ *
+ * RB function:
+ * buildtree : creates a BST from the sorted input.
+ * parallelbuild: BST, colours and successor links in one pass over one node block, subtrees built by a taskpool
+ * colortee: converts created BST to redblack with odd level colored as RED (root is at level 0)
+ * insert: inserts a node in RB BST
+ * insertFixup: maintains RB invariants during insertion
+ * deletenode: deletes a node from RB BST.
+ * deleteFixup: maintains RB invariants during delete
+ * updatesum/addsum: maintain subtree sum (msum) used by inrange, every rotation and count update keeps it valid
+ *
+ * applyBatch: apply a batch of increase/reduce ops in key order, rebuilding the tree when the batch is large
+ *
+ * map function (eventcounter):
+ * increase: increase the value associated with key, if key is not found insert it in RB BST
+ * decrease:  reduce the value associated with key, if value decreased to 0 delete that key from RB BST
+ * cout: count of value associated with key.
+ * inrange: sum of count of values between given key ranges, answered from msum in two root to leaf descents
+ * next: key and the value of the event with the lowest key  that is greater than given key
+ * previous: key and the value of the event with the greatest key that is less than given key
+ *
+ * successor/predecessor threads: every node links its neighbours in key order, set by build and kept by insert
+ * and deletenode; next/previous take one lowerbound descent and one link, a next/previous from the key of the
+ * last answer takes the link only
+ * cursor: seek(key) positions on the first event with key >= key, next/previous walk the threads; a cursor is
+ * invalid once its event is removed
+ *
+ * hot key cache (setcache): open addressing table key -> node probed before searchkey by count/increase/decrease,
+ * a hit skips the descent; a miss searches the tree and caches the node found in the first free slot of the key's
+ * CACHEPROBE slots, or over its home slot. deletenode drops the deleted key and the key it moves, deletetree clears
+ * the table. Rotations only relink nodes, a key keeps its node until it is deleted
+ *
+ * topk: secondary index of (key, count) in hotter order, created by the first topk and from then on kept by
+ * every count change in O(log n) (rerank), topk reads it in O(k); build drops it until the next topk
+ *
+ * key and count types: basic_treemap<Key, Count>, treemap is basic_treemap<int,int> (64 byte RBNode, the bbst
+ * engine), e.g. basic_treemap<int64_t, uint64_t> for 64 bit ids and counts.  msum and inrange use
+ * countsum<Count>::type (sumtype) so range totals are exact, count updates saturate at the limits of Count
+ *
+ ***************************************************************************************************************/
+template<class Key, class Count>
+class basic_treemap : public counterbase<Key,Count>::type{
+    friend class concurrentmap;
+public:
+    typedef basic_rbnode<Key,Count> RBNode;
+    typedef basic_batchop<Key,Count> batchop;
+    typedef typename RBNode::sumtype sumtype;
+private:
+    RBNode *root;
+    RBNode *nil;
+    basic_nodepool<RBNode> pool;
+    void rotateleft(RBNode* &, RBNode*&);
+    void rotateright(RBNode*&, RBNode* &);
+    void insertFixup(RBNode* &, RBNode*&);
+    void deleteFixup(RBNode*&, RBNode* &);
+    RBNode* inserthelper(RBNode*,RBNode*);
+    RBNode* successor(RBNode* , RBNode* );
+    RBNode* predecessor(RBNode* , RBNode* );
+    enum {BUILDGRAIN = 1 << 15}; // nodes per parallelbuild task
+    RBNode* placenode(vector<pair<Key,Count> >&, RBNode* block, int begin, int end, int level, int maxlevel, RBNode*);
+    RBNode* buildblock(vector<pair<Key,Count> >&, RBNode* block, int begin, int end, int level, int maxlevel, RBNode*);
+    RBNode* splitbuild(vector<pair<Key,Count> >&, RBNode* block, int begin, int end, int level, int maxlevel, RBNode*,
+                       taskpool&);
+    void splitsums(RBNode* block, int begin, int end);
+    sumtype sumless(Key key, bool inclusive);
+    inline void updatesum(RBNode* node){node->msum = node->left->msum + node->right->msum + node->mvalue;}
+    void addsum(RBNode* node, sumtype delta);
+    void levelorder(RBNode*);
+    RBNode* findmin(RBNode*);
+    RBNode* findmax(RBNode*);
+    RBNode* lowerbound(Key key);
+    void threadleaf(RBNode*);
+    RBNode* lastnext; // node returned by the last next/previous
+    typedef set<pair<Key,Count>, hotter> rankindex;
+    rankindex* ranks; // topk index, NULL until the first topk
+    inline void rerank(Key key, Count before, Count after) // count of key changes, 0 for absent
+    {
+        if(!ranks) return;
+        if(before > 0) ranks->erase(make_pair(key, before));
+        if(after > 0) ranks->insert(make_pair(key, after));
+    }
+    inline void dropranks(){delete ranks; ranks = NULL;}
+    enum {CACHEPROBE = 4, CACHEMIN = 8};
+    struct cacheslot{
+        Key key;
+        RBNode* node; // NULL: free
+    };
+    vector<cacheslot> cache; // hot key cache, empty when disabled
+    int cachebits;
+    unsigned long cachehits;
+    unsigned long cachemisses;
+    inline size_t cachehome(Key key){return (size_t)(((uint64_t)key * 0x9e3779b97f4a7c15ull) >> (64 - cachebits));}
+    RBNode* findkey(Key key);
+    void cacheput(Key key, RBNode* node);
+    void cacheerase(Key key);
+public:
+    class cursor{
+        friend class basic_treemap;
+        RBNode* node;
+        cursor(RBNode* node):node(node){}
+    public:
+        inline bool valid() const {return node != NULL;}
+        inline Key key() const {return node->mkey;}
+        inline Count value() const {return node->mvalue;}
+        inline void next(){node = node->successor;}
+        inline void previous(){node = node->predecessor;}
+    };
+    cursor seek(Key key){return cursor(lowerbound(key));}
+    int buildtree(vector<pair<Key,Count> >&);
+    int parallelbuild(vector<pair<Key,Count> >&, size_t nthreads);
+    int build(vector<pair<Key,Count> >&);
+    Count increase(Key key, Count value);
+    Count decrease(Key key, Count value);
+    Count count(Key key);
+    sumtype inrange(Key key1, Key key2);
+    sumtype rangescan(Key key1, Key key2);
+    void applyBatch(vector<batchop>& ops);
+    void exporttree(vector<pair<Key,Count> >& out);
+    void topk(int k, vector<pair<Key,Count> >& out);
+    void setcache(size_t slots);
+    inline double cachehitrate(){return cachehits + cachemisses ? (double)cachehits/(cachehits + cachemisses) : 0;}
+    inline size_t size(){return pool.inuse();}
+    bool next(Key key, pair<Key,Count>& found);
+    bool previous(Key key, pair<Key,Count>& found);
+    void insert(Key key, Count value);
+    void insertrecursive(Key key, Count value);
+    void deletenode(RBNode* &todelete, RBNode* &root);
+    void inorder(RBNode*,RBNode*&,int , int maxlevel);
+    void deletetree();
+    void colortree(int maxlevel);
+    RBNode* searchkey(RBNode* root, Key key);
+    RBNode* searchkeyrecursive(RBNode* root, Key key);
+    void levelorderprint();
+    void memoryreport();
+    basic_treemap ():root(NULL),lastnext(NULL),ranks(NULL),cachebits(0),cachehits(0),cachemisses(0){
+        nil = new RBNode(-1,-1,BLACK);// senitel nil node
+        nil->parent=nil;
+        nil->left= nil;
+        nil->right=nil;
+        nil->msum = 0;
+    };
+    inline RBNode* getroot(){return root;}
+    inline RBNode* rbnil(){return nil;}
+    ~basic_treemap()
+    {
+        delete this->nil; // tree nodes are released in bulk by pool
+        dropranks();
+    }
+};
+typedef basic_treemap<int,int> treemap;
+/************************************************************************************************************
+ * Destroy tree: all nodes live in pool, so drop them in bulk instead of walking the tree
+ ************************************************************************************************************/
+template<class Key, class Count>
+void basic_treemap<Key,Count>::deletetree()
+{
+    pool.clear();
+    root = NULL;
+    lastnext = NULL;
+    dropranks();
+    for(size_t i = 0 ; i < cache.size(); ++i)
+        cache[i].node = NULL;
+}
+
+/****************************************************************************************************************
+ * Helper funtion for Red black tree insert.
+ * This funtion insert a node in it's appropriate postion in a BST
+ * Inserted node is colored red
+ * **************************************************************************************************************/
+template<class Key, class Count>
+typename basic_treemap<Key,Count>::RBNode* basic_treemap<Key,Count>::inserthelper(RBNode* root, RBNode* curr) // Binary search tree insert
+{
+    if(root == NULL || root == rbnil())
+        return curr;
+    if(root->mkey > curr->mkey)
+    {
+        root->left = inserthelper(root->left,curr);
+        root->left->parent = root;
+    }
+    else if(root->mkey < curr->mkey) // insert at right
+    {
+        root->right = inserthelper(root->right, curr);
+        root->right->parent = root;
+    }
+    else // value equal just increment count
+        root->mvalue = addcount(root->mvalue, curr->mvalue);
+    root->msum += curr->mvalue; // every node on the insert path gains the inserted count
+    return root;
+}
+/***********************************************************************************************
+ * rotate left: Rotates the treenode in anti clockwise direction with respect to current node
+************************************************************************************************/
+template<class Key, class Count>
+void basic_treemap<Key,Count>::rotateleft(RBNode*& root, RBNode*& curr)
+{
+    RBNode* currright = curr->right;
+    curr->right = currright->left;
+    if(curr->right != rbnil())curr->right->parent = curr;
+    currright->parent = curr->parent;
+    if(curr->parent == rbnil()) // curr is root node
+        root = currright;
+    else if(curr->parent->left == curr)// current is left child
+        curr->parent->left = currright;
+    else
+        curr->parent->right = currright; // curr is right child, curr parent right now point to currright
+    currright->left = curr;
+    curr->parent = currright;
+    updatesum(curr); // curr is now child of currright, fix it first
+    updatesum(currright);
+
+}
+
+/***********************************************************************************************
+ * rotate right: Rotates the treenode in  clockwise direction with respect to current node
+************************************************************************************************/
+template<class Key, class Count>
+void basic_treemap<Key,Count>::rotateright(RBNode*& root, RBNode*& curr)
+{
+    RBNode* currleft = curr->left;
+    curr->left = currleft->right;
+    if(curr->left != rbnil())curr->left->parent = curr;
+    currleft->parent = curr->parent;
+    if(curr->parent == rbnil()) // curr is root node
+        root = currleft;
+    else if(curr->parent->left == curr)// current is left child
+        curr->parent->left = currleft;
+    else
+        curr->parent->right = currleft; // curr is right child, curr parent right now point to currleft
+    currleft->right = curr;
+    curr->parent = currleft;
+    updatesum(curr); // curr is now child of currleft, fix it first
+    updatesum(currleft);
+
+}
+/* **********************************************************************************************************************
+*          THis function restores RB tree invarients during insert
+*           case 1:uncle of curr is red
+*           case 2:uncle of curr is black and curr is right child of parent: simply leftrotate and transform to case 3
+*           case 3:uncle of curr is black and curr is left child of parent:
+                    change color of parent as black
+                    change color of grandparent as red
+                    rightrotate along grandparent
+*************************************************************************************************************************/
+template<class Key, class Count>
+void basic_treemap<Key,Count>::insertFixup(RBNode*& root, RBNode*& curr)
+{
+    while(curr != root &&  curr->parent->mcolor == RED) // loop till parent is black
+    {
+        RBNode* parent = curr->parent;
+        RBNode* g_parent = parent->parent;
+        RBNode* uncle = NULL;
+        if(g_parent->left == parent) // parent is left child
+        {
+            uncle = g_parent->right;
+            //case 1 uncle of curr is red
+            if(uncle->mcolor == RED)// no need for null check as senitel node is nil which is always black
+            {
+                g_parent->mcolor = RED;
+                uncle->mcolor = BLACK;
+                parent->mcolor = BLACK;
+                curr = g_parent;
+            }
+            else
+            {
+                if(curr == parent->right) // case 2:Transform to case 3
+                {
+                    STATS_ADD(insertrotations, 1);
+                    rotateleft(root,parent);
+                    curr = parent; // no need to adjust parent field as it is already done in rotateleft
+                    parent = curr->parent;
+                }
+                parent->mcolor = BLACK;
+                g_parent->mcolor = RED;
+                STATS_ADD(insertrotations, 1);
+                rotateright(root, g_parent);
+            }
+        }
+        else{ // symmetic case parent is right child
+            uncle  = g_parent->left;
+            if(uncle && uncle->mcolor == RED)
+            {
+                g_parent->mcolor = RED;
+                uncle->mcolor = BLACK;
+                parent->mcolor = BLACK;
+                curr = g_parent;
+            }
+            else
+            {
+                if(curr == parent->left) // case 2:Transform to case 3
+                {
+                    STATS_ADD(insertrotations, 1);
+                    rotateright(root,parent);
+                    curr = parent; // no need to adjust parent field as it is already done in rotateleft
+                    parent = curr->parent;
+                }
+                parent->mcolor = BLACK;
+                g_parent->mcolor = RED;
+                STATS_ADD(insertrotations, 1);
+                rotateleft(root, g_parent); // parent is now black loop invarient are satisfied
+            }
+        }
+    }
+    root->mcolor = BLACK; // property 2 of RBT i.e root shall be black.
+}
+/************************************************************************************************************
+ * This function inserts a node in RBTree
+ * Firstly, call inserthelper to isert node in appropriate postion in BST
+ * secondly,calls insertFixup to resolve violation of RB tree invariants
+ * **********************************************************************************************************/
+template<class Key, class Count>
+void basic_treemap<Key,Count>::insert(Key key, Count value)
+{
+    RBNode* parent = rbnil();
+    RBNode** link = &root;
+    // top down: every node on the path gains the inserted count, parent tracks where the leaf attaches
+    for(RBNode* curr = root; curr != NULL && curr != rbnil(); curr = *link)
+    {
+        curr->msum += value;
+        if(curr->mkey == key) // value equal just increment count
+        {
+            Count updated = addcount(curr->mvalue, value);
+            if(updated - curr->mvalue != value) // saturated: take back what the path gained above the count
+                addsum(curr, (sumtype)updated - curr->mvalue - value);
+            rerank(key, curr->mvalue, updated);
+            curr->mvalue = updated;
+            return;
+        }
+        parent = curr;
+        link = key < curr->mkey ? &curr->left : &curr->right;
+    }
+    RBNode * node = pool.alloc(key, value,RED); // inserted node red in color
+    node->left = rbnil(); // left  points to senitel nil
+    node->right= rbnil(); // right  points to senitel nil
+    node->parent = parent; // parent of root points to senitel nil
+    *link = node;
+    threadleaf(node);
+    cacheput(key, node); // a new key is usually hot, before insertFixup moves node up the tree
+    insertFixup(root, node);
+    rerank(key, 0, value);
+}
+/*************************************************************************************************************
+ * recursive insert through inserthelper, kept for the recursion benchmark
+ * ***********************************************************************************************************/
+template<class Key, class Count>
+void basic_treemap<Key,Count>::insertrecursive(Key key, Count value)
+{
+    dropranks(); // not kept on this path, the next topk rebuilds it
+    RBNode * node = pool.alloc(key, value,RED);
+    node->left = rbnil();
+    node->right= rbnil();
+    root = inserthelper(root,node);
+    root->parent = rbnil();
+    threadleaf(node);
+    insertFixup(root, node);
+}
+/*************************************************************************************************************
+ * threadleaf: link a new leaf between its parent and the parent's old neighbour
+ * ***********************************************************************************************************/
+template<class Key, class Count>
+void basic_treemap<Key,Count>::threadleaf(RBNode* node)
+{
+    RBNode* parent = node->parent;
+    if(parent == NULL || parent == rbnil())
+        return;
+    node->predecessor = parent->left == node ? parent->predecessor : parent;
+    node->successor = parent->left == node ? parent : parent->successor;
+    if(node->predecessor) node->predecessor->successor = node;
+    if(node->successor) node->successor->predecessor = node;
+}
+/*************************************************************************************************************
+ * Helper function to compare two string independent of case
+ * Used to parse commands
+ * ***********************************************************************************************************/
+
+bool strequal(const string & first ,const string& second)
+{
+    unsigned int len= first.size();
+    if(len != second.size() )
+        return false;
+    for(int i = 0 ; i <len;++i)
+    {
+        if(tolower(first[i])!= tolower(second[i]))
+            return false;
+    }
+    return true;
+}
+/***********************************************************************************************************
+  * Utility funtion :color last level node as RED if it is not root
+  **********************************************************************************************************/
+template<class Key, class Count>
+void basic_treemap<Key,Count>::inorder(RBNode * root,RBNode*& prev,int level, int maxlevel)
+{
+    vector<pair<RBNode*,int> > path; // (node, level) of the left spine still to visit
+    while(true)
+    {
+        for(; root != NULL && root != rbnil(); root = root->left, ++level)
+            path.push_back(make_pair(root, level));
+        if(path.empty()) break;
+        root = path.back().first;
+        level = path.back().second;
+        path.pop_back();
+        if(prev) prev->successor = root;
+        root->predecessor = prev;
+        prev = root;
+        if(level && level == maxlevel) root->mcolor = RED;// color last level as RED, if maxlevel is 0 don't recolor
+        root = root->right;
+        level++;
+    }
+}
+/***********************************************************************************************************
+  *convert created BST to RB BST: calls inorder to color
+  **********************************************************************************************************/
+template<class Key, class Count>
+void basic_treemap<Key,Count>::colortree(int maxlevel)
+{
+    RBNode* prev = NULL;
+    inorder(root,prev,0, maxlevel);
+}
+/*****************************************************************************************************************
+ * Utility function for Debug: level order travesal of a RBTree
+ * **************************************************************************************************************/
+template<class Key, class Count>
+void basic_treemap<Key,Count>::levelorder(RBNode* root)
+{
+    if(root == NULL ||  root == rbnil())
+        return;
+    queue<RBNode*>q;
+    q.push(root);
+    while(1)
+    {
+        int size = q.size();
+        if(size == 0)
+            break;
+        RBNode* temp = NULL;
+        while(size)
+        {
+            temp = q.front();
+            q.pop();
+            cout<<" key " <<temp->mkey<<" color "<<temp->mcolor<<" parent ";
+            if(temp->parent) cout<<temp->parent->mkey<<" ";
+            cout<<endl;
+            if(temp->left !=rbnil())q.push(temp->left);
+            if(temp->right!=rbnil())q.push(temp->right);
+            size--;
+        }
+        cout<<"-----------Next Level-----------"<<endl;
+    }
+}
+
+template<class Key, class Count>
+void basic_treemap<Key,Count>::levelorderprint()
+{
+    levelorder(root);
+}
+/******************************************************************************************************
+ * Utility function: Returns Node if the search key matches any node in RB BST else returns NULL
+ ******************************************************************************************************/
+template<class Key, class Count>
+typename basic_treemap<Key,Count>::RBNode* basic_treemap<Key,Count>::searchkey(RBNode* root, Key key)
+{
+    int depth = 0;
+    for(; root != NULL && root != rbnil(); ++depth) // check nil first, its key -1 is a valid event id
+    {
+        if(root->mkey == key)
+        {
+            STATS_SEARCH(depth + 1);
+            return root;
+        }
+        root = root->mkey > key ? root->left : root->right;
+    }
+    STATS_SEARCH(depth);
+    return NULL;
+}
+/******************************************************************************************************
+ * Utility function: recursive searchkey, kept for the recursion benchmark
+ ******************************************************************************************************/
+template<class Key, class Count>
+typename basic_treemap<Key,Count>::RBNode* basic_treemap<Key,Count>::searchkeyrecursive(RBNode* root, Key key)
+{
+    if(root == NULL || root == rbnil()) return NULL;
+    if(root->mkey == key)
+        return root;
+    if(root->mkey > key ) return searchkeyrecursive(root->left,key );
+    return searchkeyrecursive(root->right,key);
+}
+/******************************************************************************************************
+ * hot key cache: setcache sizes the table to slots rounded up to a power of two, 0 disables it
+ ******************************************************************************************************/
+template<class Key, class Count>
+void basic_treemap<Key,Count>::setcache(size_t slots)
+{
+    cache.clear();
+    cachebits = 0;
+    if(slots == 0)
+        return;
+    for(slots = max<size_t>(slots, CACHEMIN); ((size_t)1 << cachebits) < slots; ++cachebits);
+    cacheslot empty = {Key(), NULL};
+    cache.assign((size_t)1 << cachebits, empty);
+}
+/******************************************************************************************************
+ * findkey: searchkey through the hot key cache, absent keys are not cached
+ ******************************************************************************************************/
+template<class Key, class Count>
+typename basic_treemap<Key,Count>::RBNode* basic_treemap<Key,Count>::findkey(Key key)
+{
+    if(cache.empty())
+        return searchkey(root, key);
+    size_t mask = cache.size() - 1, home = cachehome(key);
+    for(size_t i = 0 ; i < CACHEPROBE; ++i)
+    {
+        cacheslot& slot = cache[(home + i) & mask];
+        if(slot.node && slot.key == key)
+        {
+            cachehits++;
+            return slot.node;
+        }
+    }
+    cachemisses++;
+    RBNode* node = searchkey(root, key);
+    if(node) cacheput(key, node);
+    return node;
+}
+
+template<class Key, class Count>
+void basic_treemap<Key,Count>::cacheput(Key key, RBNode* node)
+{
+    if(cache.empty())
+        return;
+    size_t mask = cache.size() - 1, home = cachehome(key);
+    cacheslot* victim = &cache[home]; // all probe slots taken: the home slot is replaced
+    for(size_t i = 0 ; i < CACHEPROBE; ++i)
+        if(!cache[(home + i) & mask].node)
+        {
+            victim = &cache[(home + i) & mask];
+            break;
+        }
+    victim->key = key;
+    victim->node = node;
+}
+
+template<class Key, class Count>
+void basic_treemap<Key,Count>::cacheerase(Key key)
+{
+    if(cache.empty())
+        return;
+    size_t mask = cache.size() - 1, home = cachehome(key);
+    for(size_t i = 0 ; i < CACHEPROBE; ++i)
+        if(cache[(home + i) & mask].node && cache[(home + i) & mask].key == key)
+            cache[(home + i) & mask].node = NULL;
+}
+/******************************************************************************************************
+ * Utility function for next and previous methods: first node with key >= search key, NULL if none
+ ******************************************************************************************************/
+template<class Key, class Count>
+typename basic_treemap<Key,Count>::RBNode* basic_treemap<Key,Count>::lowerbound(Key key)
+{
+    RBNode* found = NULL;
+    int depth = 0;
+    for(RBNode* curr = root; curr != NULL && curr != rbnil(); ++depth)
+        if(curr->mkey >= key)
+        {
+            found = curr;
+            curr = curr->left;
+        }
+        else
+            curr = curr->right;
+    STATS_SEARCH(depth);
+    return found;
+}
+/******************************************************************************************************
+ * Utility function: Returns minimum node in BST
+ ******************************************************************************************************/
+template<class Key, class Count>
+typename basic_treemap<Key,Count>::RBNode* basic_treemap<Key,Count>::findmin(RBNode* root)
+{
+    while(root->left!=rbnil())
+        root = root->left;
+    return root;
+}
+/******************************************************************************************************
+ * Utility function: Returns maximum node in BST
+ ******************************************************************************************************/
+template<class Key, class Count>
+typename basic_treemap<Key,Count>::RBNode* basic_treemap<Key,Count>::findmax(RBNode* root)
+{
+    while(root->right!=rbnil())
+        root = root->right;
+    return root;
+}
+/******************************************************************************************************
+ * Utility function: Returns inorder succesor of a node in BST
+ * if rightsubtee exist, inorder successor is minimum value on right subtree
+ * else inorder successor the parentof node when current node is leftchild of its parent
+ ******************************************************************************************************/
+template<class Key, class Count>
+typename basic_treemap<Key,Count>::RBNode* basic_treemap<Key,Count>::successor(RBNode* curr, RBNode* root)
+{
+    if(curr->right != rbnil())
+    {
+        curr = curr->right;
+        while(curr->left != rbnil())
+        {
+            curr = curr->left;
+        }
+        return curr;
+    }
+    RBNode* p_curr = curr->parent;
+    while(p_curr!=rbnil() && curr == p_curr->right)
+    {
+        curr = p_curr;
+        p_curr = curr->parent;
+    }
+    return p_curr;
+}
+/******************************************************************************************************
+ * Utility function: Returns inorder predecessor  of a node in BST
+ ******************************************************************************************************/
+template<class Key, class Count>
+typename basic_treemap<Key,Count>::RBNode* basic_treemap<Key,Count>::predecessor(RBNode* curr, RBNode* root)
+{
+    if(curr->left !=rbnil())
+    {
+        curr = curr->left;
+        while(curr->right !=rbnil())
+        {
+            curr = curr->right;
+        }
+        return curr;
+    }
+    RBNode* p_curr = curr->parent;
+    while(p_curr!=rbnil() && curr != p_curr->right)
+    {
+        curr = p_curr;
+        p_curr = curr->parent;
+    }
+    return p_curr;
+}
+/****************************************************************************************************************
+ * Maintains RB invariant while delete
+ * case A when current node is left child of parent
+ * case 1:curr node sibling is red: leftrotate along parent and change sibling color to black and parent to red
+ * case 2: curr node sibling is black and both child of sibling black : change color of sibling to red and curr
+ *         points to parent
+ * case 3: curr node sibling is black, sibling left child is red and sibling right child is black:
+ *         swtich color of sibling and it's left child and rotateright along sibling, new sibling is now leftchild
+ *         sibling
+ * case 4: curr node sibling is black, sibling right child is red
+ *         color sibling as color of parent
+ *         color parent of curr as black
+ *         color sibling right child as black
+ *         leftrotate along parent
+ *         since property restored in this set curr as root to terminate loop
+ *
+ * case B when current node is right child of its parent
+ *        this is symmetric to case A subscases.
+ ****************************************************************************************************************/
+template<class Key, class Count>
+void basic_treemap<Key,Count>::deleteFixup(RBNode*& root,RBNode*& curr)
+{
+    while( curr!= root &&  curr->mcolor == BLACK)
+    {
+        RBNode* sibling = NULL;
+        if(curr == curr->parent->left)
+        {
+            sibling = curr->parent->right;
+            if(sibling->mcolor == RED) // case 1
+            {
+                //cout<<"case 1"<<endl;
+                sibling->mcolor = BLACK;
+                curr->parent->mcolor = RED;
+                STATS_ADD(deleterotations, 1);
+                rotateleft(root,curr->parent);
+                sibling = curr->parent->right;
+            }
+            if(sibling->left->mcolor == BLACK && sibling->right->mcolor == BLACK)//case 2
+            {
+                //cout<<"case 2"<<endl;
+                sibling->mcolor = RED;
+                curr = curr->parent;
+                //cout<<"curr after case 2 "<<curr->mkey << " "<<curr->parent->mkey<<endl;
+            }
+            else
+            {
+                //cout<<"case 3"<<endl;
+                if(sibling->right->mcolor == BLACK)//case 3
+                {
+                    sibling->left->mcolor = BLACK;
+                    sibling->mcolor = RED;
+                    STATS_ADD(deleterotations, 1);
+                    rotateright(root,sibling);
+                    sibling = curr->parent->right;
+                }
+                //cout<<"case 4"<<endl;
+                sibling->mcolor = curr->parent->mcolor;//case 4
+                curr->parent->mcolor = BLACK;
+                sibling->right->mcolor = BLACK;
+                STATS_ADD(deleterotations, 1);
+                rotateleft(root,curr->parent);
+                curr = root;
+            }
+        }
+        else // symmetric case if current is right child of its parent, symmetric to left case
+        {
+            sibling = curr->parent->left;
+            if(sibling->mcolor == RED)
+            {
+                //cout<<"case 5"<<endl;
+                sibling->mcolor = BLACK;
+                curr->parent->mcolor = RED;
+                STATS_ADD(deleterotations, 1);
+                rotateright(root,curr->parent);
+                sibling = curr->parent->left;
+            }
+            if(sibling->right->mcolor == BLACK && sibling->left->mcolor == BLACK)
+            {
+                //cout<<"case 6"<<endl;
+                sibling->mcolor = RED;
+                curr = curr->parent;
+            }
+            else
+            {
+                if(sibling->left->mcolor == BLACK)
+                {
+                    // cout<<"case 7"<<endl;
+                    sibling->right->mcolor = BLACK;
+                    sibling->mcolor = RED;
+                    STATS_ADD(deleterotations, 1);
+                    rotateleft(root,sibling);
+                    sibling = curr->parent->left;
+                }
+                // cout<<"case 8"<<endl;
+                sibling->mcolor = curr->parent->mcolor;
+                curr->parent->mcolor = BLACK;
+                sibling->left->mcolor = BLACK;
+                STATS_ADD(deleterotations, 1);
+                rotateright(root,curr->parent);
+                curr = root;
+            }
+        }
+    }
+    //cout<<" rootafter fixup  "<<root->mkey<<endl;
+    curr->mcolor = BLACK;
+}
+/*********************************************************************************************************
+ * delete node from RB BST
+ * if deleted node is red no heigt changes
+ * if delted node is BLACK calls deleteFixup to preserve RB invariants as black height is decreased after
+ *          deletion
+ *******************************************************************************************************/
+template<class Key, class Count>
+void basic_treemap<Key,Count>::deletenode(RBNode* &todelete, RBNode* &root)
+{
+    if(todelete == NULL)
+    {
+        // cout<<"Error: Node not found"<<endl;
+        return;
+    }
+    // cout<<" deletenode enter"<<endl;
+    rerank(todelete->mkey, todelete->mvalue, 0);
+    cacheerase(todelete->mkey);
+    RBNode* del = rbnil();
+    //cout<<"todelete "<<todelete->mkey<< "left "<<todelete->left->mkey<<"right "<<todelete->right->mkey<<endl;
+    if(todelete->left == rbnil() || todelete->right == rbnil())
+        del = todelete;
+    else
+        del = todelete->successor; // minimum of the right subtree
+    //cout<<"todelete "<<todelete->mkey<< "left "<<todelete->left->mkey<<"right "<<todelete->right->mkey<<" del "<<del->mkey<<endl;
+    RBNode* child = del->left == rbnil()?del->right : del->left;
+    child->parent = del->parent;
+    if(del->parent == rbnil()) // node to be deleted is root
+        root = child;
+    //attach child at appropriate postion
+    if(del->parent->left == del)
+        del->parent->left = child;
+    else
+        del->parent->right = child;
+    //cout<<"before fixup"<<endl;
+    if(todelete != del)
+    {
+        cacheerase(del->mkey); // key of del moves into todelete
+        todelete->mkey = del->mkey;
+        todelete->mvalue = del->mvalue;
+    }
+    // del leaves the thread; when it differs from todelete its key moved into todelete, its predecessor
+    if(del->predecessor) del->predecessor->successor = del->successor;
+    if(del->successor) del->successor->predecessor = del->predecessor;
+    if(lastnext == del || lastnext == todelete) lastnext = NULL;
+    // subtree sums are stale from the spliced position up to root, rebuild them before rotations use them
+    for(RBNode* node = child->parent; node != rbnil(); node = node->parent)
+        updatesum(node);
+    if(del->mcolor == BLACK) // call fixup only when deleted node is black as it will violate black node count invarient
+    {
+        //cout<<"deleteFixup call"<< child->mkey<< " "<<endl;
+        deleteFixup(root,child);
+    }
+    pool.release(del);
+}
+
+/*********************************************************************************************************************
+ * Utility function: decrease count associated with a key
+ * if count drops to zero calls deltenode procedure to remove node from RB BST
+ * Returns updated count of node with key
+ *********************************************************************************************************************/
+template<class Key, class Count>
+Count basic_treemap<Key,Count>::decrease(Key key, Count value)
+{
+    STATS_OP(STAT_DECREASE);
+    RBNode* todecrease = findkey(key);
+    if(todecrease == NULL)// no need to handle for rbnil() as search will return null for nil node
+        return 0;
+    if(value >= todecrease->mvalue) // count drops to 0 or below, compared before subtracting as Count may be unsigned
+    {
+        deletenode(todecrease, root);
+        return 0;
+    }
+    Count updated = subcount(todecrease->mvalue, value);
+    addsum(todecrease, (sumtype)updated - todecrease->mvalue);
+    rerank(key, todecrease->mvalue, updated);
+    todecrease->mvalue = updated;
+    return updated;
+}
+
+/*********************************************************************************************************************
+ * Utility function: Increase count associated with a key
+ * if key not found calls insert procedure to insert node into RB BST
+ * Returns updated count of node with key
+ *********************************************************************************************************************/
+template<class Key, class Count>
+Count basic_treemap<Key,Count>::increase(Key key, Count value){
+    STATS_OP(STAT_INCREASE);
+    RBNode* toincrease = findkey(key);
+    if(toincrease == NULL) // no need to handle for rbnil() as search will return null for nil node
+    {
+        insert(key, value);
+        return value;
+    }
+    Count updated = addcount(toincrease->mvalue, value);
+    addsum(toincrease, (sumtype)updated - toincrease->mvalue);
+    rerank(key, toincrease->mvalue, updated);
+    toincrease->mvalue = updated;
+    return updated;
+}
+/*********************************************************************************************************************
+ * Utility function: count associated with a key
+ * when key not found returns 0
+ *********************************************************************************************************************/
+template<class Key, class Count>
+Count basic_treemap<Key,Count>::count(Key key)
+{
+    STATS_OP(STAT_COUNT);
+    RBNode* curr = findkey(key);
+    return curr ? curr->mvalue : 0;
+}
+/*********************************************************************************************************************
+ * Utility function: find the lowest key that is greater than search key and associated count.
+ * returns false if none exist
+ *********************************************************************************************************************/
+template<class Key, class Count>
+bool basic_treemap<Key,Count>::next(Key key, pair<Key,Count>& found)
+{
+    STATS_OP(STAT_NEXT);
+    if(root == NULL || root == rbnil())
+        return false;
+    RBNode* succ = NULL;
+    if(lastnext && lastnext->mkey == key) // walking forward from the last answer
+        succ = lastnext->successor;
+    else
+    {
+        RBNode* bound = lowerbound(key);
+        succ = bound && bound->mkey == key ? bound->successor : bound;
+    }
+    if(succ == NULL)
+        return false;
+    lastnext = succ;
+    found = make_pair(succ->mkey, succ->mvalue);
+    return true;
+}
+/*********************************************************************************************************************
+ * Utility function: find the greatest key that is smaller than search key and associated count.
+ * returns false if none exist
+ *********************************************************************************************************************/
+template<class Key, class Count>
+bool basic_treemap<Key,Count>::previous(Key key, pair<Key,Count>& found)
+{
+    STATS_OP(STAT_PREVIOUS);
+    if(root == NULL || root == rbnil())
+        return false;
+    RBNode* pre = NULL;
+    if(lastnext && lastnext->mkey == key)
+        pre = lastnext->predecessor;
+    else
+    {
+        RBNode* bound = lowerbound(key);
+        pre = bound ? bound->predecessor : findmax(root); // no key >= key: the maximum is the answer
+    }
+    if(pre == NULL)
+        return false;
+    lastnext = pre;
+    found = make_pair(pre->mkey, pre->mvalue);
+    return true;
+}
+/*********************************************************************************************************************
+ * Utility function: sum of count by visiting every node in [key1,key2], O(log n + s).
+ * one descent to key1, then the successor thread up to key2
+ * kept as reference for inrange, used by the inrange benchmark
+ *********************************************************************************************************************/
+template<class Key, class Count>
+typename basic_treemap<Key,Count>::sumtype basic_treemap<Key,Count>::rangescan(Key key1, Key key2)
+{
+    sumtype count = 0 ;
+    for(cursor walk = seek(key1); walk.valid() && walk.key() <= key2; walk.next())
+        count += walk.value();
+    return count;
+}
+/*********************************************************************************************************************
+ * Utility function: sum of count of all keys less than key (less than or equal when inclusive is set).
+ * single root to leaf descent, whole left subtree is taken from its msum when walking right
+ *********************************************************************************************************************/
+template<class Key, class Count>
+typename basic_treemap<Key,Count>::sumtype basic_treemap<Key,Count>::sumless(Key key, bool inclusive)
+{
+    sumtype total = 0;
+    RBNode* curr = root;
+    int depth = 0;
+    for(; curr != NULL && curr != rbnil(); ++depth)
+    {
+        if(curr->mkey < key || (inclusive && curr->mkey == key))
+        {
+            total += curr->left->msum + curr->mvalue;
+            curr = curr->right;
+        }
+        else
+            curr = curr->left;
+    }
+    STATS_SEARCH(depth);
+    return total;
+}
+/*********************************************************************************************************************
+ * Utility function: sum of count within given key ranges [key1,key2] in O(log n).
+ *********************************************************************************************************************/
+template<class Key, class Count>
+typename basic_treemap<Key,Count>::sumtype basic_treemap<Key,Count>::inrange(Key key1, Key key2)
+{
+    STATS_OP(STAT_INRANGE);
+    if(key2 < key1) return 0; // empty range, the difference below would underflow for unsigned sums
+    return sumless(key2, true) - sumless(key1, false);
+}
+/*********************************************************************************************************************
+ * Utility function: add delta to msum of node and all its ancestors, used when count of node changes in place
+ *********************************************************************************************************************/
+template<class Key, class Count>
+void basic_treemap<Key,Count>::addsum(RBNode* node, sumtype delta)
+{
+    for(; node != rbnil(); node = node->parent)
+        node->msum += delta;
+}
+/*********************************************************************************************************************
+ * function: Build BST from input vector.
+ * senitel nil is used for NULL
+ * explicit stack of ranges: a range creates its node and links it to its parent on the way down, the node is
+ * pushed again (node set) so its msum is computed after both subtrees
+ *********************************************************************************************************************/
+template<class Key, class Count>
+int basic_treemap<Key,Count>::buildtree(vector<pair<Key,Count> > &inp)
+{
+    struct range{
+        int begin;
+        int end;
+        int level;
+        RBNode* parent;
+        RBNode** link;  // child pointer of parent to set
+        RBNode* node;   // set once the node exists: pop means both subtrees are done
+    };
+    int maxlevel = 0 ;
+    root = rbnil();
+    vector<range> stack;
+    range whole = {0, (int)inp.size() - 1, 0, rbnil(), &root, NULL};
+    stack.push_back(whole);
+    while(!stack.empty())
+    {
+        range top = stack.back();
+        stack.pop_back();
+        if(top.node)
+        {
+            updatesum(top.node);
+            continue;
+        }
+        if(top.begin > top.end)
+        {
+            *top.link = rbnil();
+            continue;
+        }
+        int mid = top.begin+ (top.end - top.begin)/2;
+        RBNode* newnode = pool.alloc(inp[mid].first, inp[mid].second,BLACK);//make tree  even nodes black
+        newnode->parent = top.parent;
+        *top.link = newnode;
+        maxlevel = max(top.level,maxlevel);
+        range after = {0, -1, 0, NULL, NULL, newnode};
+        range left = {top.begin, mid-1, top.level+1, newnode, &newnode->left, NULL};
+        range right = {mid+1, top.end, top.level+1, newnode, &newnode->right, NULL};
+        stack.push_back(after);
+        stack.push_back(right);
+        stack.push_back(left);
+    }
+    root->parent = rbnil();// root parent is senitel
+    return maxlevel;
+}
+/*********************************************************************************************************************
+ * parallelbuild: BST, colours and successor links in one pass, nodes live in one pool block
+ * node of input position i is block[i], so every link is known before its subtree is built: successor and
+ * predecessor of block[i] are block[i+1] and block[i-1], a child is the block entry of the middle of its range and the deepest level,
+ * floor(log2(n)), is coloured RED as colortree does
+ * ranges above BUILDGRAIN nodes are split on the calling thread, smaller ranges are built by taskpool tasks;
+ * msum of the split nodes is filled bottom up once all tasks are done
+ *********************************************************************************************************************/
+template<class Key, class Count>
+typename basic_treemap<Key,Count>::RBNode* basic_treemap<Key,Count>::placenode(vector<pair<Key,Count> > &inp, RBNode* block, int begin, int end, int level, int maxlevel,
+                           RBNode* parent)
+{
+    if(begin > end) return rbnil();
+    int mid = begin+ (end - begin)/2;
+    RBNode* node = new(block + mid) RBNode(inp[mid].first, inp[mid].second, level && level == maxlevel ? RED : BLACK);
+    node->parent = parent;
+    if(mid + 1 < (int)inp.size()) node->successor = block + mid + 1;
+    if(mid > 0) node->predecessor = block + mid - 1;
+    node->left = begin > mid-1 ? rbnil() : block + begin + (mid-1 - begin)/2;
+    node->right = mid+1 > end ? rbnil() : block + mid+1 + (end - mid-1)/2;
+    return node;
+}
+
+template<class Key, class Count>
+typename basic_treemap<Key,Count>::RBNode* basic_treemap<Key,Count>::buildblock(vector<pair<Key,Count> > &inp, RBNode* block, int begin, int end, int level, int maxlevel,
+                            RBNode* parent)
+{
+    RBNode* node = placenode(inp, block, begin, end, level, maxlevel, parent);
+    if(node == rbnil()) return node;
+    int mid = node - block;
+    buildblock(inp, block, begin, mid-1, level+1, maxlevel, node);
+    buildblock(inp, block, mid+1, end, level+1, maxlevel, node);
+    updatesum(node);
+    return node;
+}
+
+template<class Key, class Count>
+typename basic_treemap<Key,Count>::RBNode* basic_treemap<Key,Count>::splitbuild(vector<pair<Key,Count> > &inp, RBNode* block, int begin, int end, int level, int maxlevel,
+                            RBNode* parent, taskpool& tasks)
+{
+    if(begin > end) return rbnil();
+    if(end - begin + 1 <= BUILDGRAIN)
+    {
+        tasks.submit([this, &inp, block, begin, end, level, maxlevel, parent]{
+            buildblock(inp, block, begin, end, level, maxlevel, parent);
+        });
+        return block + begin + (end - begin)/2; // constructed by the task
+    }
+    RBNode* node = placenode(inp, block, begin, end, level, maxlevel, parent);
+    int mid = node - block;
+    splitbuild(inp, block, begin, mid-1, level+1, maxlevel, node, tasks);
+    splitbuild(inp, block, mid+1, end, level+1, maxlevel, node, tasks);
+    return node;
+}
+
+template<class Key, class Count>
+void basic_treemap<Key,Count>::splitsums(RBNode* block, int begin, int end)
+{
+    if(end - begin + 1 <= BUILDGRAIN) return; // built by a task, msum already set
+    int mid = begin+ (end - begin)/2;
+    splitsums(block, begin, mid-1);
+    splitsums(block, mid+1, end);
+    updatesum(block + mid);
+}
+
+template<class Key, class Count>
+int basic_treemap<Key,Count>::parallelbuild(vector<pair<Key,Count> > &inp, size_t nthreads)
+{
+    int size = inp.size();
+    int maxlevel = 0;
+    while(maxlevel < 30 && (2 << maxlevel) <= size) maxlevel++;
+    RBNode* block = size ? pool.allocblock(size) : NULL;
+    if(size <= BUILDGRAIN || nthreads <= 1)
+        root = buildblock(inp, block, 0, size-1, 0, maxlevel, rbnil());
+    else
+    {
+        taskpool tasks(nthreads);
+        root = splitbuild(inp, block, 0, size-1, 0, maxlevel, rbnil(), tasks);
+        tasks.wait();
+        splitsums(block, 0, size-1);
+    }
+    root->parent = rbnil();// root parent is senitel
+    return maxlevel;
+}
+/*********************************************************************************************************************
+ * eventcounter build: drop current tree, coloured RB tree from sorted input with parallelbuild
+ *********************************************************************************************************************/
+template<class Key, class Count>
+int basic_treemap<Key,Count>::build(vector<pair<Key,Count> > &inp)
+{
+    deletetree(); // build replaces the whole content
+    return parallelbuild(inp, thread::hardware_concurrency());
+}
+/*********************************************************************************************************************
+ * export: append all (key, count) pairs in key order, walks the successor thread from the minimum
+ *********************************************************************************************************************/
+template<class Key, class Count>
+void basic_treemap<Key,Count>::exporttree(vector<pair<Key,Count> >& out)
+{
+    for(cursor walk = seek(numeric_limits<Key>::min()); walk.valid(); walk.next())
+        out.push_back(make_pair(walk.key(), walk.value()));
+}
+/*********************************************************************************************************************
+ * topk: the k hottest events from the rank index, the first call builds the index from one export, O(n log n)
+ *********************************************************************************************************************/
+template<class Key, class Count>
+void basic_treemap<Key,Count>::topk(int k, vector<pair<Key,Count> >& out)
+{
+    if(!ranks)
+    {
+        vector<pair<Key,Count> > events;
+        exporttree(events);
+        sort(events.begin(), events.end(), hotter());
+        ranks = new rankindex();
+        for(size_t i = 0 ; i < events.size(); ++i)
+            ranks->insert(ranks->end(), events[i]); // sorted input: hinted insert is amortized O(1)
+    }
+    for(typename rankindex::iterator it = ranks->begin(); it != ranks->end() && k > 0; ++it, --k)
+        out.push_back(*it);
+}
+/*********************************************************************************************************************
+ * applyBatch: apply increase/reduce ops, result of every op is set to the count a single command would print
+ * ops are ordered by (key, position) and folded per key starting from the current count, so a key reduced to 0
+ * and increased again in the same batch behaves as with one op at a time
+ * few distinct keys: every key is searched and updated once, in key order
+ * many distinct keys (8*keys >= tree size): the tree is exported, merged with the folded counts in one sorted
+ * pass and rebuilt with build
+ *********************************************************************************************************************/
+template<class Key, class Count>
+void basic_treemap<Key,Count>::applyBatch(vector<batchop>& ops)
+{
+    vector<pair<Key,int> > order(ops.size()); // (key, position), position keeps arrival order within a key
+    for(size_t i = 0 ; i < ops.size(); ++i)
+        order[i] = make_pair(ops[i].key, (int)i);
+    sort(order.begin(), order.end());
+    size_t distinct = 0;
+    for(size_t i = 0 ; i < order.size(); ++i)
+        if(i == 0 || order[i].first != order[i-1].first) distinct++;
+    bool rebuild = distinct*8 >= size();
+    vector<pair<Key,Count> > current, merged;
+    if(rebuild)
+    {
+        current.reserve(size());
+        exporttree(current);
+        merged.reserve(current.size() + distinct);
+    }
+    size_t pos = 0; // next unmerged entry of current
+    for(size_t i = 0 ; i < order.size(); )
+    {
+        Key key = order[i].first;
+        RBNode* node = NULL;
+        Count value = 0;
+        if(rebuild)
+        {
+            for(; pos < current.size() && current[pos].first < key; ++pos)
+                merged.push_back(current[pos]);
+            if(pos < current.size() && current[pos].first == key)
+                value = current[pos++].second;
+        }
+        else
+        {
+            node = searchkey(root, key);
+            if(node) value = node->mvalue;
+        }
+        for(; i < order.size() && order[i].first == key; ++i) // fold ops of key in arrival order
+        {
+            batchop& op = ops[order[i].second];
+            if(op.type == batchop::INCREASE)
+                value = addcount(value, op.value);
+            else if(value > 0)
+                value = op.value >= value ? 0 : subcount(value, op.value); // reduce to 0 or below removes key
+            op.result = value;
+        }
+        if(rebuild)
+        {
+            if(value > 0) merged.push_back(make_pair(key, value));
+        }
+        else if(node && value > 0)
+        {
+            addsum(node, (sumtype)value - node->mvalue);
+            rerank(key, node->mvalue, value);
+            node->mvalue = value;
+        }
+        else if(node)
+            deletenode(node, root);
+        else if(value > 0)
+            insert(key, value);
+    }
+    if(rebuild)
+    {
+        merged.insert(merged.end(), current.begin() + pos, current.end());
+        build(merged);
+    }
+}
+/*********************************************************************************************************************
+ * Memory report: pool usage and bytes per live event of the pointer based layout
+ *********************************************************************************************************************/
+template<class Key, class Count>
+void basic_treemap<Key,Count>::memoryreport()
+{
+    pool.printstats();
+    cout<<"layout pointer node bytes "<<sizeof(RBNode)<<" bytes per event "<<pool.bytesperlive()<<endl;
+    if(ranks) cout<<"topk index events "<<ranks->size()<<endl;
+    if(!cache.empty())
+        cout<<"cache slots "<<cache.size()<<" hits "<<cachehits<<" misses "<<cachemisses<<" hit rate "<<cachehitrate()<<endl;
+}
+/*********************************************************************************************************************
+ * compactmap: red black tree stored in one node array, links are 32 bit indices instead of pointers
+ * index 0 is the senitel nil node, so links never need a NULL check (same role as treemap nil)
+ * colour is packed in the top bit of the parent index, subtree sum is split in two 32 bit halves
+ * node is 28 bytes against 64 bytes of RBNode, at most 2^31 - 1 events
+ * deleted slots are chained through left and recycled by alloc
+ *********************************************************************************************************************/
+class compactmap : public eventcounter{
+    struct CNode{
+        int mkey;
+        int mvalue;
+        uint32_t left;
+        uint32_t right;
+        uint32_t parentcolor; // bit 31 colour, bits 0-30 parent index
+        uint32_t sumlo;       // subtree sum, low half
+        uint32_t sumhi;       // subtree sum, high half
+    };
+    enum {NIL = 0};
+    static const uint32_t COLORBIT = 0x80000000u;
+    vector<CNode> nodes;
+    uint32_t root;
+    uint32_t freelist;
+    size_t live;
+    inline uint32_t& left(uint32_t i){return nodes[i].left;}
+    inline uint32_t& right(uint32_t i){return nodes[i].right;}
+    inline uint32_t parent(uint32_t i){return nodes[i].parentcolor & ~COLORBIT;}
+    inline void setparent(uint32_t i, uint32_t p){nodes[i].parentcolor = (nodes[i].parentcolor & COLORBIT) | p;}
+    inline bool color(uint32_t i){return nodes[i].parentcolor >> 31;}
+    inline void setcolor(uint32_t i, bool c){nodes[i].parentcolor = (nodes[i].parentcolor & ~COLORBIT) | ((uint32_t)c << 31);}
+    inline long long sum(uint32_t i){return (long long)(((uint64_t)nodes[i].sumhi << 32) | nodes[i].sumlo);}
+    inline void setsum(uint32_t i, long long v){nodes[i].sumlo = (uint32_t)v; nodes[i].sumhi = (uint32_t)((uint64_t)v >> 32);}
+    inline void updatesum(uint32_t i){setsum(i, sum(left(i)) + sum(right(i)) + nodes[i].mvalue);}
+    uint32_t alloc(int key, int value, bool color);
+    void release(uint32_t);
+    void rotateleft(uint32_t);
+    void rotateright(uint32_t);
+    void insertFixup(uint32_t);
+    void deleteFixup(uint32_t);
+    void deletenode(uint32_t);
+    uint32_t searchkey(int key);
+    long long sumless(int key, bool inclusive);
+    uint32_t buildhelper(vector<pair<int,int> >&, int begin, int end, int level, int maxlevel);
+public:
+    compactmap():root(NIL),freelist(NIL),live(0){
+        nodes.resize(1);
+        nodes[NIL].mkey = nodes[NIL].mvalue = 0;
+        nodes[NIL].left = nodes[NIL].right = NIL;
+        nodes[NIL].parentcolor = COLORBIT; // nil is black
+        setsum(NIL, 0);
+    }
+    int build(vector<pair<int,int> >&);
+    int increase(int key, int value);
+    int decrease(int key, int value);
+    int count(int key);
+    long long inrange(int key1, int key2);
+    bool next(int key, pair<int,int>& found);
+    bool previous(int key, pair<int,int>& found);
+    void levelorderprint();
+    void memoryreport();
+};
+
+uint32_t compactmap::alloc(int key, int value, bool color)
+{
+    uint32_t node = freelist;
+    if(node != NIL)
+        freelist = nodes[node].left;
+    else
+    {
+        node = nodes.size();
+        nodes.push_back(CNode());
+    }
+    nodes[node].mkey = key;
+    nodes[node].mvalue = value;
+    nodes[node].left = nodes[node].right = NIL;
+    nodes[node].parentcolor = NIL;
+    setcolor(node, color);
+    setsum(node, value);
+    live++;
+    return node;
+}
+
+void compactmap::release(uint32_t node)
+{
+    nodes[node].left = freelist; // left doubles as free list link
+    freelist = node;
+    live--;
+}
+/*********************************************************************************************************************
+ * rotations: same as treemap::rotateleft/rotateright on indices
+ *********************************************************************************************************************/
+void compactmap::rotateleft(uint32_t curr)
+{
+    uint32_t currright = right(curr);
+    uint32_t cparent = parent(curr);
+    right(curr) = left(currright);
+    if(right(curr) != NIL) setparent(right(curr), curr);
+    setparent(currright, cparent);
+    if(cparent == NIL) // curr is root node
+        root = currright;
+    else if(left(cparent) == curr)
+        left(cparent) = currright;
+    else
+        right(cparent) = currright;
+    left(currright) = curr;
+    setparent(curr, currright);
+    updatesum(curr);
+    updatesum(currright);
+}
+
+void compactmap::rotateright(uint32_t curr)
+{
+    uint32_t currleft = left(curr);
+    uint32_t cparent = parent(curr);
+    left(curr) = right(currleft);
+    if(left(curr) != NIL) setparent(left(curr), curr);
+    setparent(currleft, cparent);
+    if(cparent == NIL) // curr is root node
+        root = currleft;
+    else if(left(cparent) == curr)
+        left(cparent) = currleft;
+    else
+        right(cparent) = currleft;
+    right(currleft) = curr;
+    setparent(curr, currleft);
+    updatesum(curr);
+    updatesum(currleft);
+}
+/*********************************************************************************************************************
+ * restores RB invariants after insert, cases as in treemap::insertFixup
+ *********************************************************************************************************************/
+void compactmap::insertFixup(uint32_t curr)
+{
+    while(curr != root && color(parent(curr)) == RED)
+    {
+        uint32_t par = parent(curr);
+        uint32_t g_parent = parent(par);
+        if(left(g_parent) == par)
+        {
+            uint32_t uncle = right(g_parent);
+            if(color(uncle) == RED) // case 1
+            {
+                setcolor(g_parent, RED);
+                setcolor(uncle, BLACK);
+                setcolor(par, BLACK);
+                curr = g_parent;
+            }
+            else
+            {
+                if(curr == right(par)) // case 2: transform to case 3
+                {
+                    rotateleft(par);
+                    curr = par;
+                    par = parent(curr);
+                }
+                setcolor(par, BLACK);
+                setcolor(g_parent, RED);
+                rotateright(g_parent);
+            }
+        }
+        else // symmetric case parent is right child
+        {
+            uint32_t uncle = left(g_parent);
+            if(color(uncle) == RED)
+            {
+                setcolor(g_parent, RED);
+                setcolor(uncle, BLACK);
+                setcolor(par, BLACK);
+                curr = g_parent;
+            }
+            else
+            {
+                if(curr == left(par))
+                {
+                    rotateright(par);
+                    curr = par;
+                    par = parent(curr);
+                }
+                setcolor(par, BLACK);
+                setcolor(g_parent, RED);
+                rotateleft(g_parent);
+            }
+        }
+    }
+    setcolor(root, BLACK);
+}
+/*********************************************************************************************************************
+ * restores RB invariants after delete, cases as in treemap::deleteFixup
+ *********************************************************************************************************************/
+void compactmap::deleteFixup(uint32_t curr)
+{
+    while(curr != root && color(curr) == BLACK)
+    {
+        uint32_t par = parent(curr);
+        if(curr == left(par))
+        {
+            uint32_t sibling = right(par);
+            if(color(sibling) == RED) // case 1
+            {
+                setcolor(sibling, BLACK);
+                setcolor(par, RED);
+                rotateleft(par);
+                sibling = right(par);
+            }
+            if(color(left(sibling)) == BLACK && color(right(sibling)) == BLACK) // case 2
+            {
+                setcolor(sibling, RED);
+                curr = par;
+            }
+            else
+            {
+                if(color(right(sibling)) == BLACK) // case 3
+                {
+                    setcolor(left(sibling), BLACK);
+                    setcolor(sibling, RED);
+                    rotateright(sibling);
+                    sibling = right(par);
+                }
+                setcolor(sibling, color(par)); // case 4
+                setcolor(par, BLACK);
+                setcolor(right(sibling), BLACK);
+                rotateleft(par);
+                curr = root;
+            }
+        }
+        else // symmetric case curr is right child
+        {
+            uint32_t sibling = left(par);
+            if(color(sibling) == RED)
+            {
+                setcolor(sibling, BLACK);
+                setcolor(par, RED);
+                rotateright(par);
+                sibling = left(par);
+            }
+            if(color(right(sibling)) == BLACK && color(left(sibling)) == BLACK)
+            {
+                setcolor(sibling, RED);
+                curr = par;
+            }
+            else
+            {
+                if(color(left(sibling)) == BLACK)
+                {
+                    setcolor(right(sibling), BLACK);
+                    setcolor(sibling, RED);
+                    rotateleft(sibling);
+                    sibling = left(par);
+                }
+                setcolor(sibling, color(par));
+                setcolor(par, BLACK);
+                setcolor(left(sibling), BLACK);
+                rotateright(par);
+                curr = root;
+            }
+        }
+    }
+    setcolor(curr, BLACK);
+}
+/*********************************************************************************************************************
+ * delete node: splice out node or its inorder successor (whose key/value move into node), as treemap::deletenode
+ *********************************************************************************************************************/
+void compactmap::deletenode(uint32_t todelete)
+{
+    uint32_t del = todelete;
+    if(left(todelete) != NIL && right(todelete) != NIL)
+    {
+        del = right(todelete); // inorder successor is minimum of right subtree
+        while(left(del) != NIL)
+            del = left(del);
+    }
+    uint32_t child = left(del) != NIL ? left(del) : right(del);
+    uint32_t dparent = parent(del);
+    setparent(child, dparent); // nil parent is set too, deleteFixup starts from it
+    if(dparent == NIL)
+        root = child;
+    else if(left(dparent) == del)
+        left(dparent) = child;
+    else
+        right(dparent) = child;
+    if(todelete != del)
+    {
+        nodes[todelete].mkey = nodes[del].mkey;
+        nodes[todelete].mvalue = nodes[del].mvalue;
+    }
+    for(uint32_t node = dparent; node != NIL; node = parent(node))
+        updatesum(node);
+    if(color(del) == BLACK)
+        deleteFixup(child);
+    release(del);
+}
+
+uint32_t compactmap::searchkey(int key)
+{
+    uint32_t curr = root;
+    while(curr != NIL && nodes[curr].mkey != key)
+        curr = key < nodes[curr].mkey ? left(curr) : right(curr);
+    return curr;
+}
+/*********************************************************************************************************************
+ * increase: single descent, count is added to subtree sum of every node on the path whether key is found or not
+ *********************************************************************************************************************/
+int compactmap::increase(int key, int value)
+{
+    uint32_t curr = root;
+    uint32_t par = NIL;
+    while(curr != NIL)
+    {
+        setsum(curr, sum(curr) + value);
+        if(nodes[curr].mkey == key)
+        {
+            int updated = addcount(nodes[curr].mvalue, value);
+            long long excess = (long long)nodes[curr].mvalue + value - updated;
+            if(excess) // saturated: take back what the path gained above the count
+                for(uint32_t node = curr; node != NIL; node = parent(node))
+                    setsum(node, sum(node) - excess);
+            nodes[curr].mvalue = updated;
+            return updated;
+        }
+        par = curr;
+        curr = key < nodes[curr].mkey ? left(curr) : right(curr);
+    }
+    uint32_t node = alloc(key, value, RED);
+    setparent(node, par);
+    if(par == NIL)
+        root = node;
+    else if(key < nodes[par].mkey)
+        left(par) = node;
+    else
+        right(par) = node;
+    insertFixup(node);
+    return value;
+}
+
+int compactmap::decrease(int key, int value)
+{
+    uint32_t node = searchkey(key);
+    if(node == NIL)
+        return 0;
+    if(value >= nodes[node].mvalue) // count drops to 0 or below
+    {
+        deletenode(node);
+        return 0;
+    }
+    int updated = subcount(nodes[node].mvalue, value);
+    long long delta = (long long)updated - nodes[node].mvalue;
+    nodes[node].mvalue = updated;
+    for(uint32_t curr = node; curr != NIL; curr = parent(curr))
+        setsum(curr, sum(curr) + delta);
+    return updated;
+}
+
+int compactmap::count(int key)
+{
+    return nodes[searchkey(key)].mvalue; // nil value is 0
+}
+
+long long compactmap::sumless(int key, bool inclusive)
+{
+    long long total = 0;
+    uint32_t curr = root;
+    while(curr != NIL)
+    {
+        if(nodes[curr].mkey < key || (inclusive && nodes[curr].mkey == key))
+        {
+            total += sum(left(curr)) + nodes[curr].mvalue;
+            curr = right(curr);
+        }
+        else
+            curr = left(curr);
+    }
+    return total;
+}
+
+long long compactmap::inrange(int key1, int key2)
+{
+    return sumless(key2, true) - sumless(key1, false);
+}
+/*********************************************************************************************************************
+ * next/previous: single descent remembering the last node passed on the correct side of key
+ *********************************************************************************************************************/
+bool compactmap::next(int key, pair<int,int>& found)
+{
+    uint32_t curr = root;
+    uint32_t best = NIL;
+    while(curr != NIL)
+    {
+        if(nodes[curr].mkey > key)
+        {
+            best = curr;
+            curr = left(curr);
+        }
+        else
+            curr = right(curr);
+    }
+    if(best == NIL)
+        return false;
+    found = make_pair(nodes[best].mkey, nodes[best].mvalue);
+    return true;
+}
+
+bool compactmap::previous(int key, pair<int,int>& found)
+{
+    uint32_t curr = root;
+    uint32_t best = NIL;
+    while(curr != NIL)
+    {
+        if(nodes[curr].mkey < key)
+        {
+            best = curr;
+            curr = right(curr);
+        }
+        else
+            curr = left(curr);
+    }
+    if(best == NIL)
+        return false;
+    found = make_pair(nodes[best].mkey, nodes[best].mvalue);
+    return true;
+}
+/*********************************************************************************************************************
+ * build: balanced BST from sorted input, the deepest level is colored RED in the same pass (see treemap::colortree)
+ * mid split gives depth floor(log2 n), so max level is known before building
+ *********************************************************************************************************************/
+uint32_t compactmap::buildhelper(vector<pair<int,int> > &inp, int begin, int end, int level, int maxlevel)
+{
+    if(begin > end) return NIL;
+    int mid = begin + (end - begin)/2;
+    uint32_t node = alloc(inp[mid].first, inp[mid].second, (level && level == maxlevel) ? RED : BLACK);
+    uint32_t l = buildhelper(inp, begin, mid-1, level+1, maxlevel);
+    uint32_t r = buildhelper(inp, mid+1, end, level+1, maxlevel);
+    left(node) = l;
+    right(node) = r;
+    if(l != NIL) setparent(l, node);
+    if(r != NIL) setparent(r, node);
+    updatesum(node);
+    return node;
+}
+
+int compactmap::build(vector<pair<int,int> > &inp)
+{
+    int size = inp.size();
+    int maxlevel = 0;
+    while((2 << maxlevel) <= size) maxlevel++;
+    nodes.resize(1); // build replaces the whole content, only nil is kept
+    root = freelist = NIL;
+    live = 0;
+    nodes.reserve(size + 1);
+    root = buildhelper(inp, 0, size-1, 0, maxlevel);
+    return maxlevel;
+}
+
+void compactmap::levelorderprint()
+{
+    if(root == NIL)
+        return;
+    queue<uint32_t> q;
+    q.push(root);
+    while(!q.empty())
+    {
+        int size = q.size();
+        while(size--)
+        {
+            uint32_t temp = q.front();
+            q.pop();
+            cout<<" key " <<nodes[temp].mkey<<" color "<<color(temp)<<" parent "<<nodes[parent(temp)].mkey<<" "<<endl;
+            if(left(temp) != NIL) q.push(left(temp));
+            if(right(temp) != NIL) q.push(right(temp));
+        }
+        cout<<"-----------Next Level-----------"<<endl;
+    }
+}
+/*********************************************************************************************************************
+ * Memory report: array usage and bytes per live event compared with the pointer based layout
+ *********************************************************************************************************************/
+void compactmap::memoryreport()
+{
+    size_t bytes = nodes.capacity()*sizeof(CNode);
+    cout<<"slots "<<nodes.size()-1<<" capacity "<<nodes.capacity()<<" live "<<live<<" bytes "<<bytes<<endl;
+    cout<<"layout compact node bytes "<<sizeof(CNode)<<" bytes per event "<<(live ? (double)bytes/live : 0)
+        <<" pointer node bytes "<<sizeof(RBNode)<<endl;
+}
+/*********************************************************************************************************************
+ * nodesearch: in node key search kernels for 16 key nodes (bplustree leaf and inner keys)
+ * upper returns number of keys <= key, lower returns number of keys < key, among the first n sorted keys
+ * kernels always read all NODEKEYS slots, slots past n are masked off
+ * scalar runs everywhere, sse compares 4 keys and avx2 8 keys per instruction
+ * selectkernel picks the widest kernel the cpu supports at startup
+ *********************************************************************************************************************/
+#define NODEKEYS 16
+struct nodesearch{
+    const char* name;
+    int (*upper)(const int* keys, int n, int key);
+    int (*lower)(const int* keys, int n, int key);
+};
+
+static int upperscalar(const int* keys, int n, int key)
+{
+    int i = 0;
+    while(i < n && keys[i] <= key) ++i;
+    return i;
+}
+
+static int lowerscalar(const int* keys, int n, int key)
+{
+    int i = 0;
+    while(i < n && keys[i] < key) ++i;
+    return i;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.2")))
+static unsigned greatermasksse(const int* keys, int key) // bit i set when keys[i] > key
+{
+    __m128i vkey = _mm_set1_epi32(key);
+    unsigned mask = 0;
+    for(int i = 0 ; i < NODEKEYS; i += 4)
+    {
+        __m128i cmp = _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i*)(keys + i)), vkey);
+        mask |= (unsigned)_mm_movemask_ps(_mm_castsi128_ps(cmp)) << i;
+    }
+    return mask;
+}
+
+__attribute__((target("sse4.2")))
+static int uppersse(const int* keys, int n, int key)
+{
+    return n - __builtin_popcount(greatermasksse(keys, key) & ((1u << n) - 1));
+}
+
+__attribute__((target("sse4.2")))
+static int lowersse(const int* keys, int n, int key)
+{
+    // keys[i] < key  <=>  !(keys[i] > key - 1), key - 1 would wrap for INT_MIN where no key is smaller
+    if(key == INT_MIN) return 0;
+    return n - __builtin_popcount(greatermasksse(keys, key - 1) & ((1u << n) - 1));
+}
+
+__attribute__((target("avx2")))
+static unsigned greatermaskavx2(const int* keys, int key)
+{
+    __m256i vkey = _mm256_set1_epi32(key);
+    __m256i low = _mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i*)keys), vkey);
+    __m256i high = _mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i*)(keys + 8)), vkey);
+    return (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(low))
+        | (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(high)) << 8;
+}
+
+__attribute__((target("avx2")))
+static int upperavx2(const int* keys, int n, int key)
+{
+    return n - __builtin_popcount(greatermaskavx2(keys, key) & ((1u << n) - 1));
+}
+
+__attribute__((target("avx2")))
+static int loweravx2(const int* keys, int n, int key)
+{
+    if(key == INT_MIN) return 0;
+    return n - __builtin_popcount(greatermaskavx2(keys, key - 1) & ((1u << n) - 1));
+}
+#endif
+
+static const nodesearch searchkernels[] = {
+    {"scalar", upperscalar, lowerscalar},
+#if defined(__x86_64__) || defined(__i386__)
+    {"sse", uppersse, lowersse},
+    {"avx2", upperavx2, loweravx2},
+#endif
+};
+static const int nsearchkernels = sizeof(searchkernels)/sizeof(searchkernels[0]);
+
+static const nodesearch* selectkernel()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) return &searchkernels[2];
+    if(__builtin_cpu_supports("sse4.2")) return &searchkernels[1];
+#endif
+    return &searchkernels[0];
+}
+/*********************************************************************************************************************
+ * bplustree: B+ tree engine, alternative to treemap selected by -btree
+ * inner node keys and leaf keys are sorted arrays of LEAFKEYS/INNERKEYS ints, i.e. one cache line of keys per node
+ * inner node keys[i] is the smallest key under children[i+1]
+ * in node search goes through kernel, the nodesearch chosen by selectkernel
+ * all counts live in leaves, leaves are chained so next/previous and inrange walk memory sequentially
+ * a leaf or inner node is freed only once it is empty, under-full nodes are not merged
+ *********************************************************************************************************************/
+class bplustree : public eventcounter{
+    enum {LEAFKEYS = NODEKEYS, INNERKEYS = NODEKEYS, MAXHEIGHT = 32};
+    struct alignas(64) leafnode{
+        int keys[LEAFKEYS];
+        int values[LEAFKEYS];
+        int nkeys;
+        leafnode* next;
+        leafnode* prev;
+    };
+    struct alignas(64) innernode{
+        int keys[INNERKEYS];
+        int nkeys;
+        void* children[INNERKEYS+1];
+    };
+    void* root;
+    int height; // inner levels above the leaves, 0 when root is a leaf
+    size_t nleaves;
+    size_t ninner;
+    size_t live;
+    static const nodesearch* kernel;
+    static inline int upper(const int* keys, int n, int key){return kernel->upper(keys, n, key);}
+    static inline int lower(const int* keys, int n, int key){return kernel->lower(keys, n, key);}
+    leafnode* findleaf(int key, innernode** path, int* slots);
+    void insertparent(innernode** path, int* slots, int level, int sep, void* right);
+    void removechild(innernode** path, int* slots, int level);
+    void freenode(void* node, int level);
+public:
+    bplustree():height(0),nleaves(1),ninner(0),live(0){
+        leafnode* leaf = new leafnode();
+        root = leaf;
+    }
+    ~bplustree(){freenode(root, height);}
+    int build(vector<pair<int,int> >&);
+    int increase(int key, int value);
+    int decrease(int key, int value);
+    int count(int key);
+    long long inrange(int key1, int key2);
+    bool next(int key, pair<int,int>& found);
+    bool previous(int key, pair<int,int>& found);
+    void levelorderprint();
+    void memoryreport();
+    static inline void setkernel(const nodesearch* search){kernel = search;}
+    static inline const nodesearch* getkernel(){return kernel;}
+};
+const nodesearch* bplustree::kernel = selectkernel();
+/*********************************************************************************************************************
+ * descend to the leaf that holds key, path/slots record inner nodes and child slots taken (may be NULL)
+ *********************************************************************************************************************/
+bplustree::leafnode* bplustree::findleaf(int key, innernode** path, int* slots)
+{
+    void* node = root;
+    for(int level = 0 ; level < height; ++level)
+    {
+        innernode* inner = static_cast<innernode*>(node);
+        int slot = upper(inner->keys, inner->nkeys, key);
+        if(path)
+        {
+            path[level] = inner;
+            slots[level] = slot;
+        }
+        node = inner->children[slot];
+    }
+    return static_cast<leafnode*>(node);
+}
+/*********************************************************************************************************************
+ * link new right sibling of the node at slots[level] into path[level], splitting inner nodes up to the root
+ *********************************************************************************************************************/
+void bplustree::insertparent(innernode** path, int* slots, int level, int sep, void* right)
+{
+    if(level < 0) // root was split, grow by one level
+    {
+        innernode* newroot = new innernode();
+        newroot->nkeys = 1;
+        newroot->keys[0] = sep;
+        newroot->children[0] = root;
+        newroot->children[1] = right;
+        root = newroot;
+        height++;
+        ninner++;
+        return;
+    }
+    innernode* inner = path[level];
+    int slot = slots[level];
+    if(inner->nkeys < INNERKEYS)
+    {
+        for(int i = inner->nkeys; i > slot; --i)
+        {
+            inner->keys[i] = inner->keys[i-1];
+            inner->children[i+1] = inner->children[i];
+        }
+        inner->keys[slot] = sep;
+        inner->children[slot+1] = right;
+        inner->nkeys++;
+        return;
+    }
+    int keys[INNERKEYS+1];
+    void* children[INNERKEYS+2];
+    for(int i = 0, j = 0 ; i <= INNERKEYS; ++i)
+        keys[i] = i == slot ? sep : inner->keys[j++];
+    for(int i = 0, j = 0 ; i <= INNERKEYS+1; ++i)
+        children[i] = i == slot+1 ? right : inner->children[j++];
+    int mid = (INNERKEYS+1)/2; // keys[mid] moves up
+    innernode* sibling = new innernode();
+    ninner++;
+    inner->nkeys = mid;
+    for(int i = 0 ; i < mid; ++i)
+        inner->keys[i] = keys[i];
+    for(int i = 0 ; i <= mid; ++i)
+        inner->children[i] = children[i];
+    sibling->nkeys = INNERKEYS - mid;
+    for(int i = 0 ; i < sibling->nkeys; ++i)
+        sibling->keys[i] = keys[mid+1+i];
+    for(int i = 0 ; i <= sibling->nkeys; ++i)
+        sibling->children[i] = children[mid+1+i];
+    insertparent(path, slots, level-1, keys[mid], sibling);
+}
+/*********************************************************************************************************************
+ * drop child at slots[level] of path[level], an inner node losing its last child is removed from its own parent
+ * root with a single child is collapsed so the tree height shrinks
+ *********************************************************************************************************************/
+void bplustree::removechild(innernode** path, int* slots, int level)
+{
+    innernode* inner = path[level];
+    int slot = slots[level];
+    if(inner->nkeys == 0) // single child gone, never the root as root always keeps two children
+    {
+        delete inner;
+        ninner--;
+        removechild(path, slots, level-1);
+        return;
+    }
+    int sep = slot > 0 ? slot-1 : 0; // separator bounding the removed child
+    for(int i = sep; i < inner->nkeys-1; ++i)
+        inner->keys[i] = inner->keys[i+1];
+    for(int i = slot; i < inner->nkeys; ++i)
+        inner->children[i] = inner->children[i+1];
+    inner->nkeys--;
+    while(height > 0 && static_cast<innernode*>(root)->nkeys == 0)
+    {
+        innernode* oldroot = static_cast<innernode*>(root);
+        root = oldroot->children[0];
+        delete oldroot;
+        ninner--;
+        height--;
+    }
+}
+
+void bplustree::freenode(void* node, int level)
+{
+    if(level == 0)
+    {
+        delete static_cast<leafnode*>(node);
+        return;
+    }
+    innernode* inner = static_cast<innernode*>(node);
+    for(int i = 0 ; i <= inner->nkeys; ++i)
+        freenode(inner->children[i], level-1);
+    delete inner;
+}
+/*********************************************************************************************************************
+ * increase: add to count in leaf, a missing key is inserted in order, a full leaf is split in two halves first
+ *********************************************************************************************************************/
+int bplustree::increase(int key, int value)
+{
+    innernode* path[MAXHEIGHT];
+    int slots[MAXHEIGHT];
+    leafnode* leaf = findleaf(key, path, slots);
+    int pos = lower(leaf->keys, leaf->nkeys, key);
+    if(pos < leaf->nkeys && leaf->keys[pos] == key)
+    {
+        leaf->values[pos] = addcount(leaf->values[pos], value);
+        return leaf->values[pos];
+    }
+    leafnode* right = NULL;
+    if(leaf->nkeys == LEAFKEYS)
+    {
+        int half = LEAFKEYS/2;
+        right = new leafnode();
+        nleaves++;
+        right->nkeys = LEAFKEYS - half;
+        for(int i = 0 ; i < right->nkeys; ++i)
+        {
+            right->keys[i] = leaf->keys[half+i];
+            right->values[i] = leaf->values[half+i];
+        }
+        leaf->nkeys = half;
+        right->next = leaf->next;
+        if(right->next) right->next->prev = right;
+        right->prev = leaf;
+        leaf->next = right;
+        if(pos > half) // key belongs to right half, never at its slot 0 so separator is unchanged
+        {
+            leaf = right;
+            pos -= half;
+        }
+    }
+    for(int i = leaf->nkeys; i > pos; --i)
+    {
+        leaf->keys[i] = leaf->keys[i-1];
+        leaf->values[i] = leaf->values[i-1];
+    }
+    leaf->keys[pos] = key;
+    leaf->values[pos] = value;
+    leaf->nkeys++;
+    live++;
+    if(right)
+        insertparent(path, slots, height-1, right->keys[0], right);
+    return value;
+}
+/*********************************************************************************************************************
+ * decrease: subtract from count, key is removed from its leaf once count drops to 0 or below
+ *********************************************************************************************************************/
+int bplustree::decrease(int key, int value)
+{
+    innernode* path[MAXHEIGHT];
+    int slots[MAXHEIGHT];
+    leafnode* leaf = findleaf(key, path, slots);
+    int pos = lower(leaf->keys, leaf->nkeys, key);
+    if(pos == leaf->nkeys || leaf->keys[pos] != key)
+        return 0;
+    if(value < leaf->values[pos])
+    {
+        leaf->values[pos] = subcount(leaf->values[pos], value);
+        return leaf->values[pos];
+    }
+    for(int i = pos; i < leaf->nkeys-1; ++i)
+    {
+        leaf->keys[i] = leaf->keys[i+1];
+        leaf->values[i] = leaf->values[i+1];
+    }
+    leaf->nkeys--;
+    live--;
+    if(leaf->nkeys == 0 && height > 0) // empty leaf leaves the chain and its parent, a lone root leaf stays
+    {
+        if(leaf->prev) leaf->prev->next = leaf->next;
+        if(leaf->next) leaf->next->prev = leaf->prev;
+        delete leaf;
+        nleaves--;
+        removechild(path, slots, height-1);
+    }
+    return 0;
+}
+
+int bplustree::count(int key)
+{
+    leafnode* leaf = findleaf(key, NULL, NULL);
+    int pos = lower(leaf->keys, leaf->nkeys, key);
+    if(pos < leaf->nkeys && leaf->keys[pos] == key)
+        return leaf->values[pos];
+    return 0;
+}
+/*********************************************************************************************************************
+ * inrange: descend once to key1 then sum along the leaf chain, O(log n + s/LEAFKEYS) node visits
+ *********************************************************************************************************************/
+long long bplustree::inrange(int key1, int key2)
+{
+    leafnode* leaf = findleaf(key1, NULL, NULL);
+    int pos = lower(leaf->keys, leaf->nkeys, key1);
+    long long total = 0;
+    for(; leaf; leaf = leaf->next, pos = 0)
+    {
+        for(; pos < leaf->nkeys; ++pos)
+        {
+            if(leaf->keys[pos] > key2)
+                return total;
+            total += leaf->values[pos];
+        }
+    }
+    return total;
+}
+
+bool bplustree::next(int key, pair<int,int>& found)
+{
+    leafnode* leaf = findleaf(key, NULL, NULL);
+    int pos = upper(leaf->keys, leaf->nkeys, key);
+    while(leaf && pos == leaf->nkeys)
+    {
+        leaf = leaf->next;
+        pos = 0;
+    }
+    if(leaf == NULL)
+        return false;
+    found = make_pair(leaf->keys[pos], leaf->values[pos]);
+    return true;
+}
+
+bool bplustree::previous(int key, pair<int,int>& found)
+{
+    leafnode* leaf = findleaf(key, NULL, NULL);
+    int pos = lower(leaf->keys, leaf->nkeys, key) - 1;
+    while(leaf && pos < 0)
+    {
+        leaf = leaf->prev;
+        pos = leaf ? leaf->nkeys - 1 : -1;
+    }
+    if(leaf == NULL)
+        return false;
+    found = make_pair(leaf->keys[pos], leaf->values[pos]);
+    return true;
+}
+/*********************************************************************************************************************
+ * build: bulk load full leaves from sorted input, then inner levels bottom up with children spread evenly
+ * returns height of the tree
+ *********************************************************************************************************************/
+int bplustree::build(vector<pair<int,int> > &inp)
+{
+    freenode(root, height);
+    height = 0;
+    nleaves = ninner = 0;
+    live = inp.size();
+    vector<void*> level;
+    vector<int> firstkeys; // smallest key under each node of level
+    leafnode* prev = NULL;
+    for(size_t i = 0 ; i < inp.size() || level.empty(); i += LEAFKEYS)
+    {
+        leafnode* leaf = new leafnode();
+        nleaves++;
+        leaf->nkeys = min<size_t>(LEAFKEYS, inp.size() - i);
+        for(int j = 0 ; j < leaf->nkeys; ++j)
+        {
+            leaf->keys[j] = inp[i+j].first;
+            leaf->values[j] = inp[i+j].second;
+        }
+        leaf->prev = prev;
+        if(prev) prev->next = leaf;
+        prev = leaf;
+        level.push_back(leaf);
+        firstkeys.push_back(leaf->nkeys ? leaf->keys[0] : 0);
+    }
+    while(level.size() > 1)
+    {
+        size_t groups = (level.size() + INNERKEYS) / (INNERKEYS+1);
+        vector<void*> upperlevel;
+        vector<int> upperkeys;
+        for(size_t g = 0, begin = 0 ; g < groups; ++g)
+        {
+            size_t end = level.size()*(g+1)/groups;
+            innernode* inner = new innernode();
+            ninner++;
+            inner->nkeys = end - begin - 1;
+            for(size_t i = begin; i < end; ++i)
+            {
+                inner->children[i-begin] = level[i];
+                if(i > begin) inner->keys[i-begin-1] = firstkeys[i];
+            }
+            upperlevel.push_back(inner);
+            upperkeys.push_back(firstkeys[begin]);
+            begin = end;
+        }
+        level.swap(upperlevel);
+        firstkeys.swap(upperkeys);
+        height++;
+    }
+    root = level[0];
+    return height;
+}
+
+void bplustree::levelorderprint()
+{
+    vector<void*> level(1, root);
+    for(int depth = height; depth >= 0; --depth)
+    {
+        vector<void*> below;
+        for(size_t i = 0 ; i < level.size(); ++i)
+        {
+            cout<<" [";
+            if(depth == 0)
+            {
+                leafnode* leaf = static_cast<leafnode*>(level[i]);
+                for(int j = 0 ; j < leaf->nkeys; ++j)
+                    cout<<" "<<leaf->keys[j]<<":"<<leaf->values[j];
+            }
+            else
+            {
+                innernode* inner = static_cast<innernode*>(level[i]);
+                for(int j = 0 ; j < inner->nkeys; ++j)
+                    cout<<" "<<inner->keys[j];
+                for(int j = 0 ; j <= inner->nkeys; ++j)
+                    below.push_back(inner->children[j]);
+            }
+            cout<<" ]";
+        }
+        cout<<endl<<"-----------Next Level-----------"<<endl;
+        level.swap(below);
+    }
+}
+/*********************************************************************************************************************
+ * Memory report: node counts and bytes per live event of the B+ tree
+ *********************************************************************************************************************/
+void bplustree::memoryreport()
+{
+    size_t bytes = nleaves*sizeof(leafnode) + ninner*sizeof(innernode);
+    cout<<"height "<<height<<" leaves "<<nleaves<<" inner "<<ninner<<" live "<<live<<" bytes "<<bytes<<endl;
+    cout<<"node search kernel "<<kernel->name<<endl;
+    cout<<"layout btree leaf bytes "<<sizeof(leafnode)<<" inner bytes "<<sizeof(innernode)
+        <<" bytes per event "<<(live ? (double)bytes/live : 0)<<" pointer node bytes "<<sizeof(RBNode)<<endl;
+}
+/*********************************************************************************************************************
+ * concurrentmap: thread safe treemap, selected by -concurrent
+ * writers (increase/decrease/build) serialize on writelock and make version odd while they change the tree
+ * readers (count/inrange/next/previous) take no lock: they read version, walk the tree downwards only and
+ * accept the result when version is unchanged and even, otherwise retry
+ * after OPTIMISTIC_RETRIES failed attempts a reader falls back to writelock so it can not starve
+ * increase/decrease walk safely under readers: a node released by deletenode goes to the free list of the pool
+ * and stays mapped, a walk longer than MAXDEPTH means a torn read and is retried as well
+ * build frees the pool, so it never touches the tree readers see: the new tree is built aside and swapped in
+ * under writelock, then the epoch advances and the old tree is deleted once no reader slot still holds an epoch
+ * from before the swap (readers pin a slot, as mvccmap snapshots do, for the optimistic attempts only and unpin
+ * before they fall back to writelock)
+ * readers load node fields with relaxed atomics but writers change them with the plain stores of treemap, which
+ * is a data race under the C++ memory model: the seqlock relies on GCC emitting aligned word stores untorn and
+ * on x86 ordering, so other targets (SEQLOCK_READS 0) always read under writelock
+ *********************************************************************************************************************/
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SEQLOCK_READS 1
+#else
+#define SEQLOCK_READS 0
+#endif
+class concurrentmap : public eventcounter{
+    enum {OPTIMISTIC_RETRIES = 16, MAXDEPTH = 128, MAXREADERS = 64};
+    struct alignas(64) readerslot{
+        atomic<uint64_t> pinned; // epoch pinned by a reader, 0 when the slot is free
+    };
+    readerslot slots[MAXREADERS];
+    atomic<uint64_t> epoch;
+    atomic<treemap*> tree;   // replaced by build only, changed in place by increase/decrease
+    mutex writelock;
+    atomic<unsigned long> version;
+    atomic<unsigned long> retries;
+    atomic<unsigned long> fallbacks;
+    bool optimistic;
+    template<class T> static inline T load(const T& field){return __atomic_load_n(&field, __ATOMIC_RELAXED);}
+    void beginwrite();
+    void endwrite();
+    int pin();
+    inline void unpin(int slot){slots[slot].pinned.store(0, memory_order_release);}
+    void drain(uint64_t before);
+    template<class Result, class Read> Result optimisticread(Read read);
+    static bool findcount(treemap* tree, int key, int& value);
+    static bool sumless(treemap* tree, int key, bool inclusive, long long& total);
+    static bool bound(treemap* tree, int key, bool above, pair<int,int>& found, bool& exists);
+public:
+    concurrentmap(bool lockfree = true):epoch(1),tree(new treemap()),version(0),retries(0),fallbacks(0)
+        ,optimistic(lockfree && SEQLOCK_READS){
+        for(int i = 0 ; i < MAXREADERS; ++i)
+            slots[i].pinned.store(0, memory_order_relaxed);
+    }
+    ~concurrentmap(){delete tree.load();}
+    int build(vector<pair<int,int> >&);
+    int increase(int key, int value);
+    int decrease(int key, int value);
+    int count(int key);
+    long long inrange(int key1, int key2);
+    bool next(int key, pair<int,int>& found);
+    bool previous(int key, pair<int,int>& found);
+    void topk(int k, vector<pair<int,int> >& out);
+    void levelorderprint();
+    void memoryreport();
+    inline unsigned long readretries(){return retries.load();}
+    inline unsigned long readfallbacks(){return fallbacks.load();}
+};
+
+void concurrentmap::beginwrite()
+{
+    writelock.lock();
+    version.store(version.load(memory_order_relaxed) + 1, memory_order_relaxed); // odd: write in progress
+    atomic_thread_fence(memory_order_release);
+}
+
+void concurrentmap::endwrite()
+{
+    version.store(version.load(memory_order_relaxed) + 1, memory_order_release);
+    writelock.unlock();
+}
+/*********************************************************************************************************************
+ * pin: claim a free reader slot with the current epoch, the caller loads tree only after the slot is visible
+ * drain: wait until no slot holds an epoch below before, a reader pinned later loaded the new tree
+ *********************************************************************************************************************/
+int concurrentmap::pin()
+{
+    static thread_local int hint = 0; // last slot of this thread, usually still free
+    for(;;)
+    {
+        for(int i = 0 ; i < MAXREADERS; ++i)
+        {
+            int slot = (hint + i) % MAXREADERS;
+            uint64_t free = 0;
+            if(slots[slot].pinned.load(memory_order_relaxed) == 0
+               && slots[slot].pinned.compare_exchange_strong(free, epoch.load()))
+            {
+                hint = slot;
+                return slot;
+            }
+        }
+        this_thread::yield(); // more than MAXREADERS readers
+    }
+}
+
+void concurrentmap::drain(uint64_t before)
+{
+    for(int i = 0 ; i < MAXREADERS; ++i)
+        for(uint64_t pinned; (pinned = slots[i].pinned.load()) != 0 && pinned < before; )
+            this_thread::yield();
+}
+/*********************************************************************************************************************
+ * run read until it completes between two reads of the same even version, read returns false on a torn walk
+ * optimistic off (mutex baseline of the benchmark) or too many retries: run read under writelock
+ *********************************************************************************************************************/
+template<class Result, class Read>
+Result concurrentmap::optimisticread(Read read)
+{
+    Result result;
+    if(optimistic)
+    {
+        int slot = pin();
+        for(int attempt = 0 ; attempt < OPTIMISTIC_RETRIES; ++attempt)
+        {
+            unsigned long before = version.load(memory_order_acquire);
+            if(!(before & 1) && read(tree.load(), result))
+            {
+                atomic_thread_fence(memory_order_acquire);
+                if(version.load(memory_order_relaxed) == before)
+                {
+                    unpin(slot);
+                    return result;
+                }
+            }
+            retries.fetch_add(1, memory_order_relaxed);
+            this_thread::yield();
+        }
+        unpin(slot); // before writelock: build holds it while it drains
+    }
+    lock_guard<mutex> guard(writelock);
+    if(optimistic) fallbacks.fetch_add(1, memory_order_relaxed);
+    read(tree.load(), result);
+    return result;
+}
+/*********************************************************************************************************************
+ * downward walks used by readers, same logic as treemap::searchkey/sumless with every field read once
+ *********************************************************************************************************************/
+bool concurrentmap::findcount(treemap* tree, int key, int& value)
+{
+    RBNode* nil = tree->rbnil();
+    RBNode* curr = load(tree->root);
+    value = 0;
+    for(int depth = 0 ; curr != NULL && curr != nil; ++depth)
+    {
+        if(depth == MAXDEPTH) return false;
+        int currkey = load(curr->mkey);
+        if(currkey == key)
+        {
+            value = load(curr->mvalue);
+            return true;
+        }
+        curr = key < currkey ? load(curr->left) : load(curr->right);
+    }
+    return true;
+}
+
+bool concurrentmap::sumless(treemap* tree, int key, bool inclusive, long long& total)
+{
+    RBNode* nil = tree->rbnil();
+    RBNode* curr = load(tree->root);
+    total = 0;
+    for(int depth = 0 ; curr != NULL && curr != nil; ++depth)
+    {
+        if(depth == MAXDEPTH) return false;
+        int currkey = load(curr->mkey);
+        if(currkey < key || (inclusive && currkey == key))
+        {
+            total += load(load(curr->left)->msum) + load(curr->mvalue);
+            curr = load(curr->right);
+        }
+        else
+            curr = load(curr->left);
+    }
+    return true;
+}
+/*********************************************************************************************************************
+ * bound: nearest key above (next) or below (previous) given key
+ *********************************************************************************************************************/
+bool concurrentmap::bound(treemap* tree, int key, bool above, pair<int,int>& found, bool& exists)
+{
+    RBNode* nil = tree->rbnil();
+    RBNode* curr = load(tree->root);
+    exists = false;
+    for(int depth = 0 ; curr != NULL && curr != nil; ++depth)
+    {
+        if(depth == MAXDEPTH) return false;
+        int currkey = load(curr->mkey);
+        if(above ? currkey > key : currkey < key)
+        {
+            found = make_pair(currkey, load(curr->mvalue));
+            exists = true;
+            curr = above ? load(curr->left) : load(curr->right);
+        }
+        else
+            curr = above ? load(curr->right) : load(curr->left);
+    }
+    return true;
+}
+
+/*********************************************************************************************************************
+ * build: the new tree is built outside writelock, readers and writers go on with the old one meanwhile
+ *********************************************************************************************************************/
+int concurrentmap::build(vector<pair<int,int> > &inp)
+{
+    treemap* fresh = new treemap();
+    int maxlevel = fresh->build(inp);
+    beginwrite();
+    treemap* old = tree.exchange(fresh);
+    uint64_t swapped = epoch.fetch_add(1) + 1; // readers pinned from here on load fresh
+    endwrite();
+    drain(swapped);
+    delete old;
+    return maxlevel;
+}
+
+int concurrentmap::increase(int key, int value)
+{
+    beginwrite();
+    int updated = tree.load(memory_order_relaxed)->increase(key, value);
+    endwrite();
+    return updated;
+}
+
+int concurrentmap::decrease(int key, int value)
+{
+    beginwrite();
+    int updated = tree.load(memory_order_relaxed)->decrease(key, value);
+    endwrite();
+    return updated;
+}
+
+int concurrentmap::count(int key)
+{
+    return optimisticread<int>([&](treemap* current, int& value){return findcount(current, key, value);});
+}
+
+long long concurrentmap::inrange(int key1, int key2)
+{
+    return optimisticread<long long>([&](treemap* current, long long& total){
+        long long below = 0;
+        if(!sumless(current, key2, true, total) || !sumless(current, key1, false, below))
+            return false;
+        total -= below;
+        return true;
+    });
+}
+
+bool concurrentmap::next(int key, pair<int,int>& found)
+{
+    typedef pair<bool, pair<int,int> > result;
+    result r = optimisticread<result>([&](treemap* current, result& out){
+        return bound(current, key, true, out.second, out.first);
+    });
+    found = r.second;
+    return r.first;
+}
+
+bool concurrentmap::previous(int key, pair<int,int>& found)
+{
+    typedef pair<bool, pair<int,int> > result;
+    result r = optimisticread<result>([&](treemap* current, result& out){
+        return bound(current, key, false, out.second, out.first);
+    });
+    found = r.second;
+    return r.first;
+}
+
+/*********************************************************************************************************************
+ * topk: under writelock, the first call builds the rank index of tree; readers never touch the index
+ *********************************************************************************************************************/
+void concurrentmap::topk(int k, vector<pair<int,int> >& out)
+{
+    lock_guard<mutex> guard(writelock);
+    tree.load()->topk(k, out);
+}
+
+void concurrentmap::levelorderprint()
+{
+    lock_guard<mutex> guard(writelock);
+    tree.load()->levelorderprint();
+}
+
+void concurrentmap::memoryreport()
+{
+    lock_guard<mutex> guard(writelock);
+    tree.load()->memoryreport();
+    cout<<"optimistic read retries "<<retries.load()<<" lock fallbacks "<<fallbacks.load()<<endl;
+}
+/*********************************************************************************************************************
+ * mpscqueue: bounded lock free multi producer single consumer queue of pointers (sequence numbered ring)
+ * push returns false when full, pop returns NULL when empty
+ *********************************************************************************************************************/
+template<class T>
+class mpscqueue{
+    struct cell{
+        atomic<size_t> seq;
+        T* item;
+    };
+    vector<cell> ring;
+    size_t mask;
+    alignas(64) atomic<size_t> tail; // producers
+    alignas(64) size_t head;         // consumer only
+public:
+    mpscqueue(size_t capacity):ring(capacity),mask(capacity - 1),tail(0),head(0){ // capacity power of two
+        for(size_t i = 0 ; i < capacity; ++i)
+            ring[i].seq.store(i, memory_order_relaxed);
+    }
+    bool push(T* item)
+    {
+        size_t pos = tail.load(memory_order_relaxed);
+        for(;;)
+        {
+            cell& c = ring[pos & mask];
+            intptr_t diff = (intptr_t)c.seq.load(memory_order_acquire) - (intptr_t)pos;
+            if(diff == 0)
+            {
+                if(tail.compare_exchange_weak(pos, pos + 1, memory_order_seq_cst))
+                {
+                    c.item = item;
+                    c.seq.store(pos + 1, memory_order_seq_cst);
+                    return true;
+                }
+            }
+            else if(diff < 0)
+                return false;
+            else
+                pos = tail.load(memory_order_relaxed);
+        }
+    }
+    T* pop()
+    {
+        cell& c = ring[head & mask];
+        if(c.seq.load(memory_order_seq_cst) != head + 1)
+            return NULL;
+        T* item = c.item;
+        c.seq.store(head + mask + 1, memory_order_release);
+        head++;
+        return item;
+    }
+};
+/*********************************************************************************************************************
+ * shardedmap: key range sharded front end, selected by -shards N
+ * the int id space is cut in N ranges by bounds, every range is owned by a treemap and a worker thread
+ * callers post a shardop to the owner worker queue and wait for done, only the worker touches its treemap
+ * increase/decrease/count go to one shard, inrange/next/previous are posted to every shard that can hold the
+ * answer and the replies are merged
+ * build takes the bounds from quantiles of the input so every shard starts with the same number of ids
+ *********************************************************************************************************************/
+struct shardop{
+    enum {INCREASE, DECREASE, COUNT, INRANGE, NEXT, PREVIOUS, BUILD, LEVELORDER, MEMORY, TOPK};
+    int type;
+    int key1;
+    int key2;
+    int result;
+    long long total;
+    pair<int,int> found;
+    bool exists;
+    vector<pair<int,int> >* input; // BUILD input, TOPK output
+    atomic<bool> done;
+    shardop(int optype, int k1 = 0, int k2 = 0):type(optype),key1(k1),key2(k2),result(0),total(0),exists(false),input(NULL),done(false){}
+};
+
+class shardedmap : public eventcounter{
+    enum {QUEUESIZE = 4096, SPINS = 64};
+    struct shard{
+        treemap tree;
+        mpscqueue<shardop> queue;
+        thread worker;
+        mutex sleeplock;
+        condition_variable wakeup;
+        atomic<bool> sleeping;
+        atomic<bool> stop;
+        unsigned long ops;
+        shard():queue(QUEUESIZE),sleeping(false),stop(false),ops(0){}
+    };
+    vector<shard*> shards;
+    vector<int> bounds; // shard i holds keys in [bounds[i-1], bounds[i])
+    static void run(shard*);
+    static void execute(shard*, shardop*);
+    int owner(int key);
+    void post(int s, shardop* op);
+    void wait(shardop* op);
+public:
+    shardedmap(int nshards);
+    ~shardedmap();
+    int build(vector<pair<int,int> >&);
+    int increase(int key, int value);
+    int decrease(int key, int value);
+    int count(int key);
+    long long inrange(int key1, int key2);
+    bool next(int key, pair<int,int>& found);
+    bool previous(int key, pair<int,int>& found);
+    void topk(int k, vector<pair<int,int> >& out);
+    void levelorderprint();
+    void memoryreport();
+};
+
+shardedmap::shardedmap(int nshards)
+{
+    for(int i = 1 ; i < nshards; ++i) // even split of the whole int range until build sees the data
+        bounds.push_back((int)(INT_MIN + (long long)i*((1LL << 32)/nshards)));
+    for(int i = 0 ; i < nshards; ++i)
+    {
+        shards.push_back(new shard());
+        shards[i]->worker = thread(run, shards[i]);
+    }
+}
+
+shardedmap::~shardedmap()
+{
+    for(size_t i = 0 ; i < shards.size(); ++i)
+    {
+        {
+            lock_guard<mutex> guard(shards[i]->sleeplock);
+            shards[i]->stop = true;
+        }
+        shards[i]->wakeup.notify_one();
+        shards[i]->worker.join();
+        delete shards[i];
+    }
+}
+/*********************************************************************************************************************
+ * worker loop: drain queue, spin a little when idle, then sleep until a producer posts
+ *********************************************************************************************************************/
+void shardedmap::run(shard* s)
+{
+    for(;;)
+    {
+        shardop* op = s->queue.pop();
+        for(int spin = 0 ; op == NULL && spin < SPINS; ++spin)
+        {
+            this_thread::yield();
+            op = s->queue.pop();
+        }
+        if(op)
+        {
+            execute(s, op);
+            continue;
+        }
+        unique_lock<mutex> guard(s->sleeplock);
+        s->sleeping.store(true);
+        while(!s->stop && (op = s->queue.pop()) == NULL)
+            s->wakeup.wait(guard);
+        s->sleeping.store(false);
+        if(op == NULL) // stop
+            return;
+        guard.unlock();
+        execute(s, op);
+    }
+}
+
+void shardedmap::execute(shard* s, shardop* op)
+{
+    switch(op->type)
+    {
+        case shardop::INCREASE: op->result = s->tree.increase(op->key1, op->key2); break;
+        case shardop::DECREASE: op->result = s->tree.decrease(op->key1, op->key2); break;
+        case shardop::COUNT: op->result = s->tree.count(op->key1); break;
+        case shardop::INRANGE: op->total = s->tree.inrange(op->key1, op->key2); break;
+        case shardop::NEXT: op->exists = s->tree.next(op->key1, op->found); break;
+        case shardop::PREVIOUS: op->exists = s->tree.previous(op->key1, op->found); break;
+        case shardop::BUILD: op->result = s->tree.build(*op->input); break;
+        case shardop::LEVELORDER: s->tree.levelorderprint(); break;
+        case shardop::MEMORY: s->tree.memoryreport(); break;
+        case shardop::TOPK: s->tree.topk(op->key1, *op->input); break;
+    }
+    s->ops++;
+    op->done.store(true, memory_order_release);
+}
+
+int shardedmap::owner(int key)
+{
+    return upper_bound(bounds.begin(), bounds.end(), key) - bounds.begin();
+}
+
+void shardedmap::post(int s, shardop* op)
+{
+    while(!shards[s]->queue.push(op)) // full queue: let the worker catch up
+        this_thread::yield();
+    if(shards[s]->sleeping.load())
+    {
+        lock_guard<mutex> guard(shards[s]->sleeplock);
+        shards[s]->wakeup.notify_one();
+    }
+}
+
+void shardedmap::wait(shardop* op)
+{
+    while(!op->done.load(memory_order_acquire))
+        this_thread::yield();
+}
+/*********************************************************************************************************************
+ * build: bounds at input quantiles, then every shard builds its slice in parallel, returns deepest shard level
+ *********************************************************************************************************************/
+int shardedmap::build(vector<pair<int,int> > &inp)
+{
+    int nshards = shards.size();
+    if(inp.size() >= (size_t)nshards)
+        for(int i = 1 ; i < nshards; ++i)
+            bounds[i-1] = inp[inp.size()*i/nshards].first;
+    vector<vector<pair<int,int> > > slices(nshards);
+    for(size_t i = 0 ; i < inp.size(); ++i)
+        slices[owner(inp[i].first)].push_back(inp[i]);
+    vector<shardop*> ops;
+    for(int s = 0 ; s < nshards; ++s)
+    {
+        ops.push_back(new shardop(shardop::BUILD));
+        ops[s]->input = &slices[s];
+        post(s, ops[s]);
+    }
+    int maxlevel = 0;
+    for(int s = 0 ; s < nshards; ++s)
+    {
+        wait(ops[s]);
+        maxlevel = max(maxlevel, ops[s]->result);
+        delete ops[s];
+    }
+    return maxlevel;
+}
+
+int shardedmap::increase(int key, int value)
+{
+    shardop op(shardop::INCREASE, key, value);
+    post(owner(key), &op);
+    wait(&op);
+    return op.result;
+}
+
+int shardedmap::decrease(int key, int value)
+{
+    shardop op(shardop::DECREASE, key, value);
+    post(owner(key), &op);
+    wait(&op);
+    return op.result;
+}
+
+int shardedmap::count(int key)
+{
+    shardop op(shardop::COUNT, key);
+    post(owner(key), &op);
+    wait(&op);
+    return op.result;
+}
+
+long long shardedmap::inrange(int key1, int key2)
+{
+    int first = owner(key1), last = owner(key2);
+    vector<shardop*> ops;
+    for(int s = first ; s <= last; ++s)
+    {
+        ops.push_back(new shardop(shardop::INRANGE, key1, key2));
+        post(s, ops.back());
+    }
+    long long total = 0;
+    for(size_t i = 0 ; i < ops.size(); ++i)
+    {
+        wait(ops[i]);
+        total += ops[i]->total;
+        delete ops[i];
+    }
+    return total;
+}
+/*********************************************************************************************************************
+ * next: ask owner of key and all shards above it, the lowest shard with an answer wins
+ *********************************************************************************************************************/
+bool shardedmap::next(int key, pair<int,int>& found)
+{
+    int first = owner(key);
+    vector<shardop*> ops;
+    for(int s = first ; s < (int)shards.size(); ++s)
+    {
+        ops.push_back(new shardop(shardop::NEXT, key));
+        post(s, ops.back());
+    }
+    bool exists = false;
+    for(size_t i = 0 ; i < ops.size(); ++i)
+    {
+        wait(ops[i]);
+        if(!exists && ops[i]->exists)
+        {
+            exists = true;
+            found = ops[i]->found;
+        }
+        delete ops[i];
+    }
+    return exists;
+}
+/*********************************************************************************************************************
+ * previous: ask owner of key and all shards below it, the highest shard with an answer wins
+ *********************************************************************************************************************/
+bool shardedmap::previous(int key, pair<int,int>& found)
+{
+    int last = owner(key);
+    vector<shardop*> ops;
+    for(int s = last ; s >= 0; --s)
+    {
+        ops.push_back(new shardop(shardop::PREVIOUS, key));
+        post(s, ops.back());
+    }
+    bool exists = false;
+    for(size_t i = 0 ; i < ops.size(); ++i)
+    {
+        wait(ops[i]);
+        if(!exists && ops[i]->exists)
+        {
+            exists = true;
+            found = ops[i]->found;
+        }
+        delete ops[i];
+    }
+    return exists;
+}
+
+/*********************************************************************************************************************
+ * topk: every shard answers its own k hottest, the k hottest of the union are the answer
+ *********************************************************************************************************************/
+void shardedmap::topk(int k, vector<pair<int,int> >& out)
+{
+    vector<vector<pair<int,int> > > replies(shards.size());
+    vector<shardop*> ops;
+    for(size_t s = 0 ; s < shards.size(); ++s)
+    {
+        ops.push_back(new shardop(shardop::TOPK, k));
+        ops[s]->input = &replies[s];
+        post(s, ops[s]);
+    }
+    vector<pair<int,int> > merged;
+    for(size_t s = 0 ; s < shards.size(); ++s)
+    {
+        wait(ops[s]);
+        merged.insert(merged.end(), replies[s].begin(), replies[s].end());
+        delete ops[s];
+    }
+    size_t n = min(merged.size(), (size_t)max(k, 0));
+    partial_sort(merged.begin(), merged.begin() + n, merged.end(), hotter());
+    out.insert(out.end(), merged.begin(), merged.begin() + n);
+}
+
+void shardedmap::levelorderprint()
+{
+    for(size_t s = 0 ; s < shards.size(); ++s)
+    {
+        cout<<"-----------Shard "<<s<<"-----------"<<endl;
+        shardop op(shardop::LEVELORDER);
+        post(s, &op);
+        wait(&op);
+    }
+}
+
+void shardedmap::memoryreport()
+{
+    for(size_t s = 0 ; s < shards.size(); ++s)
+    {
+        cout<<"shard "<<s<<" from "<<(s ? bounds[s-1] : INT_MIN)<<endl;
+        shardop op(shardop::MEMORY);
+        post(s, &op);
+        wait(&op);
+        cout<<"ops "<<shards[s]->ops<<endl;
+    }
+}
+/*********************************************************************************************************************
+ * combiningmap: write combining layer for hot increase counters, backed by one treemap
+ * add(key, value) only updates a small open addressing table private to the calling thread (deltabuffer)
+ * a full table is flushed into the tree as one batch sorted by key under treelock
+ * every other operation is consistent: increase/decrease/count/inrange/next/previous first flush the buffers
+ * of all threads, so results match applying every add immediately
+ * reduce is never buffered, it may delete a key and has to see all pending increases of that key
+ *********************************************************************************************************************/
+class combiningmap : public eventcounter{
+    enum {SLOTBITS = 12, BUFFERSLOTS = 1 << SLOTBITS, BUFFERLIMIT = BUFFERSLOTS*3/4}; // flush at 75% load
+    struct deltabuffer{
+        mutex lock; // taken by owner thread on add and by flushall, uncontended in steady state
+        int keys[BUFFERSLOTS];
+        int deltas[BUFFERSLOTS];
+        bool used[BUFFERSLOTS];
+        int size;
+        deltabuffer():size(0){fill(used, used + BUFFERSLOTS, false);}
+    };
+    treemap tree;
+    mutex treelock;
+    mutex registrylock;
+    vector<deltabuffer*> buffers;
+    unsigned long id; // tells buffers of this map apart in thread local lookup
+    atomic<unsigned long> flushes;
+    atomic<unsigned long> flushedkeys;
+    static atomic<unsigned long> nextid;
+    deltabuffer* localbuffer();
+    void flush(deltabuffer*);
+    void flushall();
+    static inline unsigned slot(int key){return ((unsigned)key * 2654435761u) >> (32 - SLOTBITS);}
+public:
+    combiningmap():id(nextid++),flushes(0),flushedkeys(0){}
+    ~combiningmap();
+    void add(int key, int value);
+    int build(vector<pair<int,int> >&);
+    int increase(int key, int value);
+    int decrease(int key, int value);
+    int count(int key);
+    long long inrange(int key1, int key2);
+    bool next(int key, pair<int,int>& found);
+    bool previous(int key, pair<int,int>& found);
+    void topk(int k, vector<pair<int,int> >& out);
+    void levelorderprint();
+    void memoryreport();
+};
+atomic<unsigned long> combiningmap::nextid(0);
+
+combiningmap::~combiningmap()
+{
+    for(size_t i = 0 ; i < buffers.size(); ++i)
+        delete buffers[i];
+}
+/*********************************************************************************************************************
+ * buffer of calling thread, created and registered on first use
+ *********************************************************************************************************************/
+combiningmap::deltabuffer* combiningmap::localbuffer()
+{
+    static thread_local vector<pair<unsigned long, deltabuffer*> > owned;
+    for(size_t i = 0 ; i < owned.size(); ++i)
+        if(owned[i].first == id)
+            return owned[i].second;
+    deltabuffer* buffer = new deltabuffer();
+    {
+        lock_guard<mutex> guard(registrylock);
+        buffers.push_back(buffer);
+    }
+    owned.push_back(make_pair(id, buffer));
+    return buffer;
+}
+/*********************************************************************************************************************
+ * apply pending deltas of buffer in key order, caller holds buffer->lock
+ *********************************************************************************************************************/
+void combiningmap::flush(deltabuffer* buffer)
+{
+    if(buffer->size == 0)
+        return;
+    vector<pair<int,int> > batch;
+    batch.reserve(buffer->size);
+    for(int i = 0 ; i < BUFFERSLOTS; ++i)
+        if(buffer->used[i])
+        {
+            batch.push_back(make_pair(buffer->keys[i], buffer->deltas[i]));
+            buffer->used[i] = false;
+        }
+    buffer->size = 0;
+    sort(batch.begin(), batch.end());
+    lock_guard<mutex> guard(treelock);
+    for(size_t i = 0 ; i < batch.size(); ++i)
+        tree.increase(batch[i].first, batch[i].second);
+    flushes.fetch_add(1, memory_order_relaxed);
+    flushedkeys.fetch_add(batch.size(), memory_order_relaxed);
+}
+
+void combiningmap::flushall()
+{
+    lock_guard<mutex> guard(registrylock);
+    for(size_t i = 0 ; i < buffers.size(); ++i)
+    {
+        lock_guard<mutex> bufferguard(buffers[i]->lock);
+        flush(buffers[i]);
+    }
+}
+/*********************************************************************************************************************
+ * add: combine value into the thread local delta of key, linear probing, flush at BUFFERLIMIT entries
+ * or the combined delta would overflow
+ *********************************************************************************************************************/
+void combiningmap::add(int key, int value)
+{
+    deltabuffer* buffer = localbuffer();
+    lock_guard<mutex> guard(buffer->lock);
+    unsigned i = slot(key);
+    while(buffer->used[i] && buffer->keys[i] != key)
+        i = (i + 1) & (BUFFERSLOTS - 1);
+    if(buffer->used[i])
+    {
+        int combined;
+        if(!__builtin_add_overflow(buffer->deltas[i], value, &combined))
+        {
+            buffer->deltas[i] = combined;
+            return;
+        }
+        flush(buffer); // pending delta goes to the tree, value starts a new entry in the empty table
+        i = slot(key);
+    }
+    buffer->keys[i] = key;
+    buffer->deltas[i] = value;
+    buffer->used[i] = true;
+    if(++buffer->size == BUFFERLIMIT)
+        flush(buffer);
+}
+
+int combiningmap::build(vector<pair<int,int> > &inp)
+{
+    flushall();
+    lock_guard<mutex> guard(treelock);
+    return tree.build(inp);
+}
+
+int combiningmap::increase(int key, int value)
+{
+    flushall();
+    lock_guard<mutex> guard(treelock);
+    return tree.increase(key, value);
+}
+
+int combiningmap::decrease(int key, int value)
+{
+    flushall();
+    lock_guard<mutex> guard(treelock);
+    return tree.decrease(key, value);
+}
+
+int combiningmap::count(int key)
+{
+    flushall();
+    lock_guard<mutex> guard(treelock);
+    return tree.count(key);
+}
+
+long long combiningmap::inrange(int key1, int key2)
+{
+    flushall();
+    lock_guard<mutex> guard(treelock);
+    return tree.inrange(key1, key2);
+}
+
+bool combiningmap::next(int key, pair<int,int>& found)
+{
+    flushall();
+    lock_guard<mutex> guard(treelock);
+    return tree.next(key, found);
+}
+
+bool combiningmap::previous(int key, pair<int,int>& found)
+{
+    flushall();
+    lock_guard<mutex> guard(treelock);
+    return tree.previous(key, found);
+}
+
+void combiningmap::topk(int k, vector<pair<int,int> >& out)
+{
+    flushall();
+    lock_guard<mutex> guard(treelock);
+    tree.topk(k, out);
+}
+
+void combiningmap::levelorderprint()
+{
+    flushall();
+    lock_guard<mutex> guard(treelock);
+    tree.levelorderprint();
+}
+
+void combiningmap::memoryreport()
+{
+    flushall();
+    lock_guard<mutex> guard(treelock);
+    tree.memoryreport();
+    cout<<"delta buffers "<<buffers.size()<<" flushes "<<flushes.load()<<" keys flushed "<<flushedkeys.load()<<endl;
+}
+/*********************************************************************************************************************
+ * windowmap: counts of the last window seconds only, selected by -window S [-buckets N]
+ * time is cut in buckets of span = S/N seconds (N divides S, the window is exact), every bucket is a treemap holding
+ * the increases made in it;
+ * the ring keeps the N newest buckets, head is the current one
+ * rotate: when the clock enters a new bucket the oldest ones are dropped with treemap::deletetree, which releases
+ * their whole node pool in bulk, no per event expiry
+ * count/inrange/next/previous combine the live buckets, O(N log n); build puts the input in the current bucket
+ * decrease takes from the newest bucket first
+ * clock: wall clock seconds until the first tick, from then on event time, the largest tick seen; a tick before the
+ * clock is rejected, an increase stamped before the clock goes to the bucket of its time and is dropped when that
+ * bucket already left the window
+ *********************************************************************************************************************/
+class windowmap : public eventcounter{
+    vector<treemap*> ring;
+    int head;             // ring slot of the current bucket
+    long long headepoch;  // clock / span of the current bucket
+    long long span;
+    long long clock;
+    bool eventtime;       // a tick was seen, clock no longer follows the wall clock
+    void rotate();
+    inline treemap* bucket(int age){return ring[(head - age + ring.size()) % ring.size()];} // 0: current
+public:
+    windowmap(long long window, int nbuckets);
+    ~windowmap();
+    int build(vector<pair<int,int> >&);
+    int increase(int key, int value);
+    int decrease(int key, int value);
+    int count(int key);
+    long long inrange(int key1, int key2);
+    bool next(int key, pair<int,int>& found);
+    bool previous(int key, pair<int,int>& found);
+    void exporttree(vector<pair<int,int> >& out);
+    bool tick(long long now);
+    int increaseat(int key, int value, long long when);
+    bool timed(){return true;}
+    void levelorderprint();
+    void memoryreport();
+};
+
+windowmap::windowmap(long long window, int nbuckets):head(0),span(window / nbuckets)
+    ,clock(time(NULL)),eventtime(false)
+{
+    headepoch = clock / span;
+    for(int i = 0 ; i < nbuckets; ++i)
+        ring.push_back(new treemap());
+}
+
+windowmap::~windowmap()
+{
+    for(size_t i = 0 ; i < ring.size(); ++i)
+        delete ring[i];
+}
+/*********************************************************************************************************************
+ * rotate: move head to the bucket of the clock, every bucket it passes is emptied in bulk
+ *********************************************************************************************************************/
+void windowmap::rotate()
+{
+    if(!eventtime) clock = max(clock, (long long)time(NULL));
+    long long epoch = clock / span;
+    for(long long step = 0 ; headepoch + step < epoch && step < (long long)ring.size(); ++step)
+    {
+        head = (head + 1) % ring.size();
+        ring[head]->deletetree();
+    }
+    headepoch = max(headepoch, epoch);
+}
+
+bool windowmap::tick(long long now)
+{
+    if(now < 0 || (eventtime && now < clock))
+        return false;
+    if(!eventtime) // switch to event time, the current bucket becomes the bucket of now
+    {
+        eventtime = true;
+        clock = now;
+        headepoch = now / span;
+        return true;
+    }
+    clock = now;
+    rotate();
+    return true;
+}
+
+int windowmap::build(vector<pair<int,int> > &inp)
+{
+    rotate();
+    for(size_t i = 0 ; i < ring.size(); ++i)
+        ring[i]->deletetree();
+    return bucket(0)->build(inp);
+}
+
+int windowmap::increase(int key, int value)
+{
+    rotate();
+    bucket(0)->increase(key, value);
+    return count(key);
+}
+/*********************************************************************************************************************
+ * increaseat: a time at or after the clock ticks first, a late one goes to the bucket of its time while that bucket
+ * is in the ring; returns the windowed count, unchanged when the event is dropped
+ *********************************************************************************************************************/
+int windowmap::increaseat(int key, int value, long long when)
+{
+    if(tick(when))
+        return increase(key, value);
+    rotate();
+    long long age = headepoch - when / span;
+    if(when >= 0 && age < (long long)ring.size())
+        bucket(age)->increase(key, value);
+    return count(key);
+}
+
+int windowmap::decrease(int key, int value)
+{
+    rotate();
+    if(value <= 0) // no count is taken away, same as treemap::decrease on the current bucket
+        bucket(0)->decrease(key, value);
+    for(int age = 0 ; age < (int)ring.size() && value > 0; ++age)
+    {
+        int have = bucket(age)->count(key);
+        bucket(age)->decrease(key, min(have, value));
+        value -= min(have, value);
+    }
+    return count(key);
+}
+/*********************************************************************************************************************
+ * count: sum over the live buckets, saturated at INT_MAX
+ *********************************************************************************************************************/
+int windowmap::count(int key)
+{
+    rotate();
+    long long total = 0;
+    for(size_t i = 0 ; i < ring.size(); ++i)
+        total += ring[i]->count(key);
+    return min(total, (long long)INT_MAX);
+}
+
+long long windowmap::inrange(int key1, int key2)
+{
+    rotate();
+    long long total = 0;
+    for(size_t i = 0 ; i < ring.size(); ++i)
+        total += ring[i]->inrange(key1, key2);
+    return total;
+}
+/*********************************************************************************************************************
+ * next/previous: nearest key over all buckets, its count is the windowed count
+ *********************************************************************************************************************/
+bool windowmap::next(int key, pair<int,int>& found)
+{
+    rotate();
+    bool exists = false;
+    pair<int,int> candidate;
+    for(size_t i = 0 ; i < ring.size(); ++i)
+        if(ring[i]->next(key, candidate) && (!exists || candidate.first < found.first))
+        {
+            exists = true;
+            found = candidate;
+        }
+    if(exists) found.second = count(found.first);
+    return exists;
+}
+
+bool windowmap::previous(int key, pair<int,int>& found)
+{
+    rotate();
+    bool exists = false;
+    pair<int,int> candidate;
+    for(size_t i = 0 ; i < ring.size(); ++i)
+        if(ring[i]->previous(key, candidate) && (!exists || candidate.first > found.first))
+        {
+            exists = true;
+            found = candidate;
+        }
+    if(exists) found.second = count(found.first);
+    return exists;
+}
+/*********************************************************************************************************************
+ * export: all bucket exports sorted by key, counts of a key in several buckets are added (saturated)
+ *********************************************************************************************************************/
+void windowmap::exporttree(vector<pair<int,int> >& out)
+{
+    rotate();
+    vector<pair<int,int> > events;
+    for(size_t i = 0 ; i < ring.size(); ++i)
+        ring[i]->exporttree(events);
+    sort(events.begin(), events.end());
+    for(size_t i = 0 ; i < events.size(); ++i)
+        if(i && events[i].first == events[i-1].first)
+            out.back().second = addcount(out.back().second, events[i].second);
+        else
+            out.push_back(events[i]);
+}
+
+void windowmap::levelorderprint()
+{
+    rotate();
+    for(int age = 0 ; age < (int)ring.size(); ++age)
+    {
+        cout<<"-----------Bucket from "<<(headepoch - age)*span<<"-----------"<<endl;
+        bucket(age)->levelorderprint();
+    }
+}
+
+void windowmap::memoryreport()
+{
+    rotate();
+    cout<<"window "<<span*ring.size()<<" seconds, "<<ring.size()<<" buckets of "<<span<<", clock "<<clock
+        <<(eventtime ? " (event time)" : " (wall clock)")<<endl;
+    for(int age = 0 ; age < (int)ring.size(); ++age)
+        if(bucket(age)->size())
+        {
+            cout<<"bucket from "<<(headepoch - age)*span<<" events "<<bucket(age)->size()<<endl;
+            bucket(age)->memoryreport();
+        }
+}
+/*********************************************************************************************************************
+ * staticmap: read mostly engine, selected by -static
+ * the sorted input is laid out in Eytzinger (BFS) order: eyt[1] is the root, children of eyt[k] are eyt[2k] and
+ * eyt[2k+1]; 16 keys share a 64 byte line so the prefetch of eyt[16k] fetches the descendants 4 levels down
+ * lowerbound descends without branches, k = 2k + (eyt[k] < key), and the answer is recovered by dropping the
+ * trailing 1 bits (the right turns after the last left turn) of k
+ * rankof maps an Eytzinger slot to its rank in key order, prefix[r] is the sum of counts of ranks < r: inrange is two
+ * searches and one subtraction, the count of rank r is prefix[r+1] - prefix[r]
+ * the first increase/reduce builds a treemap from the arrays (thaw), frees them and forwards every call from then on
+ *********************************************************************************************************************/
+class staticmap : public eventcounter{
+    struct alignas(64) keyline{
+        int keys[16];
+    };
+    vector<keyline> lines; // Eytzinger keys, slot 0 unused
+    int* eyt;
+    vector<int> rankof;    // Eytzinger slot -> rank in key order
+    vector<int> keys;      // keys in key order
+    vector<long long> prefix;
+    size_t n;
+    treemap* dynamic;      // set by the first mutation
+    void layout(size_t slot, size_t& rank);
+    size_t slotbound(int key); // Eytzinger slot of the first key >= key, 0 if none
+    size_t rankbound(int key){size_t slot = slotbound(key); return slot ? rankof[slot] : n;}
+    void thaw();
+public:
+    staticmap():eyt(NULL),n(0),dynamic(NULL){}
+    ~staticmap(){delete dynamic;}
+    int build(vector<pair<int,int> >&);
+    int increase(int key, int value);
+    int decrease(int key, int value);
+    int count(int key);
+    long long inrange(int key1, int key2);
+    bool next(int key, pair<int,int>& found);
+    bool previous(int key, pair<int,int>& found);
+    void exporttree(vector<pair<int,int> >& out);
+    void topk(int k, vector<pair<int,int> >& out);
+    void levelorderprint();
+    void memoryreport();
+};
+/*********************************************************************************************************************
+ * layout: in order walk of the implicit tree, hands out ranks 0..n-1 to the slots, depth is log2(n)
+ *********************************************************************************************************************/
+void staticmap::layout(size_t slot, size_t& rank)
+{
+    if(slot > n) return;
+    layout(2*slot, rank);
+    eyt[slot] = keys[rank];
+    rankof[slot] = rank++;
+    layout(2*slot + 1, rank);
+}
+
+int staticmap::build(vector<pair<int,int> > &inp)
+{
+    delete dynamic;
+    dynamic = NULL;
+    n = inp.size();
+    keys.resize(n);
+    prefix.assign(n + 1, 0);
+    for(size_t i = 0 ; i < n; ++i)
+    {
+        keys[i] = inp[i].first;
+        prefix[i+1] = prefix[i] + inp[i].second;
+    }
+    lines.assign(n/16 + 1, keyline());
+    eyt = lines[0].keys;
+    rankof.assign(n + 1, 0);
+    size_t rank = 0;
+    layout(1, rank);
+    int maxlevel = 0;
+    while(maxlevel < 62 && ((size_t)2 << maxlevel) <= n) maxlevel++;
+    return maxlevel;
+}
+
+size_t staticmap::slotbound(int key)
+{
+    size_t k = 1;
+    while(k <= n)
+    {
+        __builtin_prefetch(eyt + 16*k);
+        k = 2*k + (eyt[k] < key);
+    }
+    return k >> __builtin_ffsll(~k);
+}
+/*********************************************************************************************************************
+ * thaw: move the events into a treemap, the static arrays are released
+ *********************************************************************************************************************/
+void staticmap::thaw()
+{
+    vector<pair<int,int> > events;
+    exporttree(events);
+    dynamic = new treemap();
+    dynamic->build(events);
+    vector<keyline>().swap(lines);
+    vector<int>().swap(rankof);
+    vector<int>().swap(keys);
+    vector<long long>().swap(prefix);
+    eyt = NULL;
+    n = 0;
+}
+
+int staticmap::increase(int key, int value)
+{
+    if(!dynamic) thaw();
+    return dynamic->increase(key, value);
+}
+
+int staticmap::decrease(int key, int value)
+{
+    if(!dynamic) thaw();
+    return dynamic->decrease(key, value);
+}
+
+int staticmap::count(int key)
+{
+    if(dynamic) return dynamic->count(key);
+    size_t slot = slotbound(key);
+    if(!slot || eyt[slot] != key)
+        return 0;
+    size_t rank = rankof[slot];
+    return prefix[rank+1] - prefix[rank];
+}
+
+long long staticmap::inrange(int key1, int key2)
+{
+    if(dynamic) return dynamic->inrange(key1, key2);
+    if(key2 < key1) return 0;
+    return prefix[key2 == INT_MAX ? n : rankbound(key2 + 1)] - prefix[rankbound(key1)];
+}
+
+bool staticmap::next(int key, pair<int,int>& found)
+{
+    if(dynamic) return dynamic->next(key, found);
+    size_t rank = key == INT_MAX ? n : rankbound(key + 1);
+    if(rank == n)
+        return false;
+    found = make_pair(keys[rank], (int)(prefix[rank+1] - prefix[rank]));
+    return true;
+}
+
+bool staticmap::previous(int key, pair<int,int>& found)
+{
+    if(dynamic) return dynamic->previous(key, found);
+    size_t rank = rankbound(key);
+    if(rank == 0)
+        return false;
+    found = make_pair(keys[rank-1], (int)(prefix[rank] - prefix[rank-1]));
+    return true;
+}
+
+void staticmap::exporttree(vector<pair<int,int> >& out)
+{
+    if(dynamic) return dynamic->exporttree(out);
+    for(size_t rank = 0 ; rank < n; ++rank)
+        out.push_back(make_pair(keys[rank], (int)(prefix[rank+1] - prefix[rank])));
+}
+
+void staticmap::topk(int k, vector<pair<int,int> >& out)
+{
+    if(dynamic) return dynamic->topk(k, out);
+    eventcounter::topk(k, out);
+}
+/*********************************************************************************************************************
+ * levelorderprint: the Eytzinger array is the level order, level l is slots [2^l, 2^(l+1))
+ *********************************************************************************************************************/
+void staticmap::levelorderprint()
+{
+    if(dynamic) return dynamic->levelorderprint();
+    for(size_t first = 1 ; first <= n; first *= 2)
+    {
+        for(size_t slot = first ; slot < 2*first && slot <= n; ++slot)
+            cout<<" key "<<eyt[slot]<<endl;
+        cout<<"-----------Next Level-----------"<<endl;
+    }
+}
+
+void staticmap::memoryreport()
+{
+    if(dynamic)
+    {
+        cout<<"static layout thawed into treemap"<<endl;
+        return dynamic->memoryreport();
+    }
+    size_t bytes = lines.size()*sizeof(keyline) + rankof.size()*sizeof(int) + keys.size()*sizeof(int)
+                 + prefix.size()*sizeof(long long);
+    cout<<"layout static eytzinger events "<<n<<" bytes "<<bytes<<" bytes per event "<<(n ? (double)bytes/n : 0)<<endl;
+}
+/*********************************************************************************************************************
+ * mvccmap: multi version event counter, selected by -mvcc
+ * persistent AVL tree with subtree sums (MNode), a published node is never changed again: a writer copies the
+ * root to leaf path it changes (path copying) and publishes the new root, so every old root stays a complete,
+ * consistent version of the map
+ * snapshot: O(1), pins the current epoch in a reader slot and keeps the root it read; reads take no lock and
+ * never block writers, writers serialize on writelock only among themselves
+ * reclamation (epoch based): nodes replaced by a write are retired with the epoch current at publish, then the
+ * epoch advances; a retired node is recycled once every pinned slot holds a later epoch, a reader pinned at that
+ * point read its root after the node was unlinked; every publish reclaims, so a tree replaced by build/load or the
+ * path of a write is recycled as soon as no reader pins an older epoch, not only once a batch has built up
+ * a long running snapshot therefore holds back every node retired after it was opened
+ *********************************************************************************************************************/
+struct MNode{
+    int mkey;
+    int mvalue;
+    int height;
+    uint64_t stamp;   // write that created the node, nodes of the running write are changed in place
+    long long msum;
+    MNode* left;
+    MNode* right;
+};
+
+class mvccmap : public eventcounter{
+    enum {MAXREADERS = 64};
+    struct alignas(64) readerslot{
+        atomic<uint64_t> pinned; // epoch pinned by a reader, 0 when the slot is free
+    };
+    readerslot slots[MAXREADERS];
+    atomic<MNode*> root;
+    atomic<uint64_t> epoch;
+    mutex writelock;
+    uint64_t stamp;                          // current write
+    vector<MNode*> unlinked;                 // replaced by the current write
+    deque<pair<uint64_t, MNode*> > retired;  // (epoch, node) in epoch order
+    vector<MNode*> spare;                    // reclaimed nodes, reused by alloc
+    size_t live;
+    size_t allocated;
+    static inline int height(MNode* node){return node ? node->height : 0;}
+    static inline long long sum(MNode* node){return node ? node->msum : 0;}
+    static inline void fix(MNode* node)
+    {
+        node->height = max(height(node->left), height(node->right)) + 1;
+        node->msum = sum(node->left) + sum(node->right) + node->mvalue;
+    }
+    MNode* alloc(int key, int value);
+    MNode* own(MNode*);
+    void drop(MNode*);
+    MNode* rotateleft(MNode*);
+    MNode* rotateright(MNode*);
+    MNode* balance(MNode*);
+    MNode* insert(MNode*, int key, int value, int& result);
+    MNode* remove(MNode*, int key, int value, int& result);
+    MNode* removemin(MNode*, int& key, int& value);
+    MNode* buildhelper(vector<pair<int,int> >&, int begin, int end);
+    void unlinktree(MNode*);
+    void freetree(MNode*);
+    void publish(MNode* newroot);
+    void reclaim();
+    int pin();
+    inline void unpin(int slot){slots[slot].pinned.store(0, memory_order_release);}
+public:
+    class snapshot{
+        friend class mvccmap;
+        mvccmap* owner;
+        int slot;
+        MNode* top;
+        snapshot(mvccmap* owner, int slot, MNode* top):owner(owner),slot(slot),top(top){}
+        snapshot(const snapshot&);
+        snapshot& operator=(const snapshot&);
+    public:
+        snapshot(snapshot&& other):owner(other.owner),slot(other.slot),top(other.top){other.owner = NULL;}
+        ~snapshot(){if(owner) owner->unpin(slot);}
+        int count(int key) const;
+        long long inrange(int key1, int key2) const;
+        bool next(int key, pair<int,int>& found) const;
+        bool previous(int key, pair<int,int>& found) const;
+        void exporttree(vector<pair<int,int> >& out) const;
+    };
+    mvccmap();
+    ~mvccmap();
+    snapshot opensnapshot();
+    int build(vector<pair<int,int> >&);
+    int increase(int key, int value);
+    int decrease(int key, int value);
+    int count(int key){return opensnapshot().count(key);}
+    long long inrange(int key1, int key2){return opensnapshot().inrange(key1, key2);}
+    bool next(int key, pair<int,int>& found){return opensnapshot().next(key, found);}
+    bool previous(int key, pair<int,int>& found){return opensnapshot().previous(key, found);}
+    void exporttree(vector<pair<int,int> >& out){opensnapshot().exporttree(out);}
+    void levelorderprint();
+    void memoryreport();
+};
+
+mvccmap::mvccmap():root(NULL),epoch(1),stamp(0),live(0),allocated(0)
+{
+    for(int i = 0 ; i < MAXREADERS; ++i)
+        slots[i].pinned.store(0);
+}
+
+mvccmap::~mvccmap()
+{
+    freetree(root.load());
+    for(size_t i = 0 ; i < retired.size(); ++i)
+        delete retired[i].second;
+    for(size_t i = 0 ; i < spare.size(); ++i)
+        delete spare[i];
+}
+
+void mvccmap::freetree(MNode* node)
+{
+    if(node == NULL) return;
+    freetree(node->left);
+    freetree(node->right);
+    delete node;
+}
+/*********************************************************************************************************************
+ * pin: claim a free reader slot with the current epoch, the caller reads root only after the slot is visible
+ *********************************************************************************************************************/
+int mvccmap::pin()
+{
+    static thread_local int hint = 0; // last slot of this thread, usually still free
+    for(;;)
+    {
+        for(int i = 0 ; i < MAXREADERS; ++i)
+        {
+            int slot = (hint + i) % MAXREADERS;
+            uint64_t free = 0;
+            if(slots[slot].pinned.load(memory_order_relaxed) == 0
+               && slots[slot].pinned.compare_exchange_strong(free, epoch.load()))
+            {
+                hint = slot;
+                return slot;
+            }
+        }
+        this_thread::yield(); // more than MAXREADERS open snapshots
+    }
+}
+
+mvccmap::snapshot mvccmap::opensnapshot()
+{
+    int slot = pin();
+    return snapshot(this, slot, root.load());
+}
+/*********************************************************************************************************************
+ * writer side, every function below runs under writelock
+ * own: node that the current write may change, a published node is copied and the original unlinked
+ * drop: node leaves the tree, recycled at once when the current write created it
+ *********************************************************************************************************************/
+MNode* mvccmap::alloc(int key, int value)
+{
+    MNode* node = NULL;
+    if(spare.empty())
+    {
+        node = new MNode;
+        allocated++;
+    }
+    else
+    {
+        node = spare.back();
+        spare.pop_back();
+    }
+    node->mkey = key;
+    node->mvalue = value;
+    node->height = 1;
+    node->stamp = stamp;
+    node->msum = value;
+    node->left = node->right = NULL;
+    return node;
+}
+
+MNode* mvccmap::own(MNode* node)
+{
+    if(node->stamp == stamp)
+        return node;
+    MNode* copy = alloc(node->mkey, node->mvalue);
+    *copy = *node;
+    copy->stamp = stamp;
+    unlinked.push_back(node);
+    return copy;
+}
+
+void mvccmap::drop(MNode* node)
+{
+    if(node->stamp == stamp)
+        spare.push_back(node);
+    else
+        unlinked.push_back(node);
+}
+
+MNode* mvccmap::rotateleft(MNode* node)
+{
+    MNode* pivot = own(node->right);
+    node->right = pivot->left;
+    pivot->left = node;
+    fix(node);
+    fix(pivot);
+    return pivot;
+}
+
+MNode* mvccmap::rotateright(MNode* node)
+{
+    MNode* pivot = own(node->left);
+    node->left = pivot->right;
+    pivot->right = node;
+    fix(node);
+    fix(pivot);
+    return pivot;
+}
+
+MNode* mvccmap::balance(MNode* node)
+{
+    fix(node);
+    int skew = height(node->left) - height(node->right);
+    if(skew > 1)
+    {
+        if(height(node->left->left) < height(node->left->right))
+            node->left = rotateleft(own(node->left));
+        return rotateright(node);
+    }
+    if(skew < -1)
+    {
+        if(height(node->right->right) < height(node->right->left))
+            node->right = rotateright(own(node->right));
+        return rotateleft(node);
+    }
+    return node;
+}
+
+MNode* mvccmap::insert(MNode* node, int key, int value, int& result)
+{
+    if(node == NULL)
+    {
+        live++;
+        result = value;
+        return alloc(key, value);
+    }
+    node = own(node);
+    if(key < node->mkey)
+        node->left = insert(node->left, key, value, result);
+    else if(key > node->mkey)
+        node->right = insert(node->right, key, value, result);
+    else
+        result = node->mvalue = addcount(node->mvalue, value);
+    return balance(node);
+}
+
+MNode* mvccmap::removemin(MNode* node, int& key, int& value)
+{
+    if(node->left == NULL)
+    {
+        key = node->mkey;
+        value = node->mvalue;
+        MNode* right = node->right;
+        drop(node);
+        return right;
+    }
+    node = own(node);
+    node->left = removemin(node->left, key, value);
+    return balance(node);
+}
+
+MNode* mvccmap::remove(MNode* node, int key, int value, int& result)
+{
+    if(key != node->mkey)
+    {
+        node = own(node);
+        if(key < node->mkey)
+            node->left = remove(node->left, key, value, result);
+        else
+            node->right = remove(node->right, key, value, result);
+        return balance(node);
+    }
+    if(node->mvalue > value)
+    {
+        node = own(node);
+        result = node->mvalue = subcount(node->mvalue, value);
+        fix(node);
+        return node;
+    }
+    result = 0;
+    live--;
+    if(node->left == NULL || node->right == NULL)
+    {
+        MNode* child = node->left ? node->left : node->right;
+        drop(node);
+        return child;
+    }
+    node = own(node);
+    node->right = removemin(node->right, node->mkey, node->mvalue);
+    return balance(node);
+}
+
+MNode* mvccmap::buildhelper(vector<pair<int,int> > &inp, int begin, int end)
+{
+    if(begin > end) return NULL;
+    int mid = begin + (end - begin)/2;
+    MNode* node = alloc(inp[mid].first, inp[mid].second);
+    node->left = buildhelper(inp, begin, mid-1);
+    node->right = buildhelper(inp, mid+1, end);
+    fix(node);
+    return node;
+}
+
+void mvccmap::unlinktree(MNode* node)
+{
+    if(node == NULL) return;
+    unlinktree(node->left);
+    unlinktree(node->right);
+    unlinked.push_back(node);
+}
+/*********************************************************************************************************************
+ * publish: make newroot the current version, retire the nodes it no longer reaches and advance the epoch
+ *********************************************************************************************************************/
+void mvccmap::publish(MNode* newroot)
+{
+    root.store(newroot);
+    uint64_t current = epoch.load();
+    for(size_t i = 0 ; i < unlinked.size(); ++i)
+        retired.push_back(make_pair(current, unlinked[i]));
+    unlinked.clear();
+    epoch.store(current + 1);
+    if(!retired.empty())
+        reclaim();
+}
+
+void mvccmap::reclaim()
+{
+    uint64_t oldest = UINT64_MAX; // oldest pinned epoch
+    for(int i = 0 ; i < MAXREADERS; ++i)
+    {
+        uint64_t pinned = slots[i].pinned.load();
+        if(pinned) oldest = min(oldest, pinned);
+    }
+    while(!retired.empty() && retired.front().first < oldest)
+    {
+        spare.push_back(retired.front().second);
+        retired.pop_front();
+    }
+}
+
+int mvccmap::build(vector<pair<int,int> > &inp)
+{
+    lock_guard<mutex> guard(writelock);
+    stamp++;
+    unlinktree(root.load());
+    live = inp.size();
+    publish(buildhelper(inp, 0, (int)inp.size() - 1));
+    MNode* top = root.load();
+    return top ? top->height - 1 : 0;
+}
+
+int mvccmap::increase(int key, int value)
+{
+    lock_guard<mutex> guard(writelock);
+    stamp++;
+    int result = 0;
+    publish(insert(root.load(), key, value, result));
+    return result;
+}
+
+int mvccmap::decrease(int key, int value)
+{
+    lock_guard<mutex> guard(writelock);
+    MNode* top = root.load();
+    MNode* node = top;
+    while(node && node->mkey != key)
+        node = key < node->mkey ? node->left : node->right;
+    if(node == NULL)
+        return 0; // absent key, no new version
+    stamp++;
+    int result = 0;
+    publish(remove(top, key, value, result));
+    return result;
+}
+/*********************************************************************************************************************
+ * snapshot reads: plain walks of the pinned version, no node of it changes or is recycled while it is pinned
+ *********************************************************************************************************************/
+int mvccmap::snapshot::count(int key) const
+{
+    for(MNode* node = top; node; node = key < node->mkey ? node->left : node->right)
+        if(node->mkey == key)
+            return node->mvalue;
+    return 0;
+}
+
+long long mvccmap::snapshot::inrange(int key1, int key2) const
+{
+    long long below1 = 0, upto2 = 0; // sum of keys < key1, sum of keys <= key2
+    for(MNode* node = top; node; )
+        if(node->mkey < key1)
+        {
+            below1 += sum(node->left) + node->mvalue;
+            node = node->right;
+        }
+        else
+            node = node->left;
+    for(MNode* node = top; node; )
+        if(node->mkey <= key2)
+        {
+            upto2 += sum(node->left) + node->mvalue;
+            node = node->right;
+        }
+        else
+            node = node->left;
+    return upto2 - below1;
+}
+
+bool mvccmap::snapshot::next(int key, pair<int,int>& found) const
+{
+    MNode* best = NULL;
+    for(MNode* node = top; node; )
+        if(node->mkey > key)
+        {
+            best = node;
+            node = node->left;
+        }
+        else
+            node = node->right;
+    if(best) found = make_pair(best->mkey, best->mvalue);
+    return best != NULL;
+}
+
+bool mvccmap::snapshot::previous(int key, pair<int,int>& found) const
+{
+    MNode* best = NULL;
+    for(MNode* node = top; node; )
+        if(node->mkey < key)
+        {
+            best = node;
+            node = node->right;
+        }
+        else
+            node = node->left;
+    if(best) found = make_pair(best->mkey, best->mvalue);
+    return best != NULL;
+}
+
+void mvccmap::snapshot::exporttree(vector<pair<int,int> >& out) const
+{
+    vector<MNode*> path; // left spine of the unvisited part
+    for(MNode* node = top; node || !path.empty(); )
+    {
+        for(; node; node = node->left)
+            path.push_back(node);
+        node = path.back();
+        path.pop_back();
+        out.push_back(make_pair(node->mkey, node->mvalue));
+        node = node->right;
+    }
+}
+
+void mvccmap::levelorderprint()
+{
+    snapshot view = opensnapshot();
+    queue<MNode*> q;
+    if(view.top) q.push(view.top);
+    while(!q.empty())
+    {
+        for(size_t size = q.size(); size; --size)
+        {
+            MNode* node = q.front();
+            q.pop();
+            cout<<" key "<<node->mkey<<" height "<<node->height<<" sum "<<node->msum<<endl;
+            if(node->left) q.push(node->left);
+            if(node->right) q.push(node->right);
+        }
+        cout<<"-----------Next Level-----------"<<endl;
+    }
+}
+
+void mvccmap::memoryreport()
+{
+    lock_guard<mutex> guard(writelock);
+    cout<<"mvcc live "<<live<<" retired "<<retired.size()<<" spare "<<spare.size()<<" allocated "<<allocated
+        <<" epoch "<<epoch.load()<<" node bytes "<<sizeof(MNode)<<endl;
+}
+/*********************************************************************************************************************
+ * Utility function: print supported commands
+ *********************************************************************************************************************/
+static const char* usagetext =
+    " ______________________________________________________________\n"
+    "| map created, enter commands in specified format              |\n"
+    "|______________________________________________________________|\n"
+    "|* command: increase  | format increase <id_INT> <count_INT>   |\n"
+    "|                     |   [<time_INT>] with -window            |\n"
+    "|* command: reduce    | format reduce   <id_INT> <count_INT>   |\n"
+    "|* command: count     | format count    <id_INT>               |\n"
+    "|* command: inRange   | format inrange  <id_INT> <id_INT>      |\n"
+    "|* command: next      | format next     <id_INT>               |\n"
+    "|* command: previous  | format previous <id_INT>               |\n"
+    "|* command: topk      | format topk     <k_INT>                |\n"
+    "|* command: tick      | format tick     <time_INT>             |\n"
+    "|* command: levelorder| format levelorder                      |\n"
+    "|* command: poolstats | format poolstats                       |\n"
+    "|* command: stats     | format stats                           |\n"
+    "|* command: save      | format save     <file>                 |\n"
+    "|* command: load      | format load     <file>                 |\n"
+    "|* command: quit      | format quit                            |\n"
+    "|______________________________________________________________|\n";
+
+void printusage()
+{
+    std::cout<<usagetext;
+    std::cout.flush();
+}
+/*********************************************************************************************************************
+ * outbuffer: results are formatted into one large buffer and written with a single fwrite when it fills
+ * or on flush, putint is a hand rolled integer formatter
+ * with a committer the engine commits before the buffered results are written
+ *********************************************************************************************************************/
+class outbuffer{
+    enum {CAPACITY = 1 << 20, SLACK = 64}; // SLACK: room for one formatted line
+    char* buf;
+    size_t used;
+    FILE* out;
+    eventcounter* committer; // results are written only after committer->commit()
+public:
+    outbuffer(FILE* file, eventcounter* committer = NULL):buf(new char[CAPACITY]),used(0),out(file)
+        ,committer(committer){}
+    ~outbuffer(){flush(); delete[] buf;}
+    inline void put(char c)
+    {
+        buf[used++] = c;
+        if(used > CAPACITY - SLACK) flush();
+    }
+    inline void put(const char* text)
+    {
+        for(; *text; ++text)
+            put(*text);
+    }
+    inline void putint(long long value)
+    {
+        char digits[24];
+        int n = 0;
+        unsigned long long magnitude = value < 0 ? 0ULL - (unsigned long long)value : value;
+        do
+        {
+            digits[n++] = '0' + magnitude % 10;
+            magnitude /= 10;
+        } while(magnitude);
+        if(value < 0) buf[used++] = '-';
+        while(n) buf[used++] = digits[--n];
+        if(used > CAPACITY - SLACK) flush();
+    }
+    void flush()
+    {
+        if(used && committer) committer->commit();
+        if(used) fwrite(buf, 1, used, out);
+        fflush(out);
+        used = 0;
+    }
+};
+/*********************************************************************************************************************
+ * binary command protocol: fixed 12 byte records of three host order int32, opcode then two params
+ * unused params are ignored, a BIN_QUIT record or end of input stops the command loop
+ * results are printed as text lines, same as the text commands
+ * BIN_TICK carries a 64 bit time, param1 low and param2 high 32 bits, and prints nothing
+ *********************************************************************************************************************/
+enum {BIN_QUIT = 0, BIN_INCREASE = 1, BIN_REDUCE = 2, BIN_COUNT = 3, BIN_INRANGE = 4, BIN_NEXT = 5, BIN_PREVIOUS = 6,
+      BIN_TOPK = 7, BIN_TICK = 8};
+struct binarycommand{
+    int32_t op;
+    int32_t param1;
+    int32_t param2;
+};
+/*********************************************************************************************************************
+ * runcommand: execute one decoded command and append its result to out, returns false on quit
+ *********************************************************************************************************************/
+static bool runcommand(eventcounter* counter, const binarycommand& cmd, outbuffer& out)
+{
+    pair<int,int> found;
+    vector<pair<int,int> > hottest;
+    switch(cmd.op)
+    {
+        case BIN_QUIT:
+            return false;
+        case BIN_INCREASE:
+            if(cmd.param2 <= 0)
+            {
+                out.put("Not a valid input param 2 try again with value greater than 0\n");
+                return true;
+            }
+            out.putint(counter->increase(cmd.param1, cmd.param2));
+            break;
+        case BIN_REDUCE:
+            out.putint(counter->decrease(cmd.param1, cmd.param2));
+            break;
+        case BIN_COUNT:
+            out.putint(counter->count(cmd.param1));
+            break;
+        case BIN_INRANGE:
+            if(cmd.param2 < cmd.param1)
+            {
+                out.put("Error! key1 shall be less than key2 \n");
+                return true;
+            }
+            out.putint(counter->inrange(cmd.param1, cmd.param2));
+            break;
+        case BIN_NEXT:
+        case BIN_PREVIOUS:
+            if(cmd.op == BIN_NEXT ? counter->next(cmd.param1, found) : counter->previous(cmd.param1, found))
+            {
+                out.putint(found.first);
+                out.put(' ');
+                out.putint(found.second);
+            }
+            else
+                out.put("0 0");
+            break;
+        case BIN_TOPK: // id count pairs on one line, hottest first
+            if(cmd.param1 <= 0)
+            {
+                out.put("Not a valid input param 1 try again with value greater than 0\n");
+                return true;
+            }
+            counter->topk(cmd.param1, hottest);
+            for(size_t i = 0 ; i < hottest.size(); ++i)
+            {
+                if(i) out.put(' ');
+                out.putint(hottest[i].first);
+                out.put(' ');
+                out.putint(hottest[i].second);
+            }
+            if(hottest.empty())
+                out.put("0 0");
+            break;
+        case BIN_TICK:
+            if(!counter->timed())
+            {
+                out.put("Error ! time needs -window\n");
+                return true;
+            }
+            if(!counter->tick((long long)((uint64_t)(uint32_t)cmd.param2 << 32 | (uint32_t)cmd.param1)))
+                out.put("Error ! time is before the clock\n");
+            return true;
+        default:
+            out.put("Error ! Wrong opcode\n");
+            return true;
+    }
+    out.put('\n');
+    return true;
+}
+/*********************************************************************************************************************
+ * runbinary: decode records straight from a large read buffer, output is flushed once per block read
+ * returns the records run, quit included
+ *********************************************************************************************************************/
+static size_t runbinary(eventcounter* counter, int fd, FILE* results = stdout)
+{
+    const size_t blocksize = 1 << 20;
+    vector<char> block(blocksize);
+    outbuffer out(results, counter);
+    size_t have = 0, commands = 0;
+    ssize_t got;
+    while((got = read(fd, &block[0] + have, blocksize - have)) > 0)
+    {
+        have += got;
+        size_t records = have / sizeof(binarycommand);
+        binarycommand cmd;
+        for(size_t i = 0 ; i < records; ++i)
+        {
+            memcpy(&cmd, &block[i*sizeof(binarycommand)], sizeof(binarycommand));
+            commands++;
+            if(!runcommand(counter, cmd, out))
+                return commands;
+        }
+        have -= records*sizeof(binarycommand); // partial record waits for the next read
+        memmove(&block[0], &block[records*sizeof(binarycommand)], have);
+        out.flush();
+    }
+    return commands;
+}
+/*********************************************************************************************************************
+ * snapshot: binary image of the live events, written by the save command and read by load or at startup
+ * layout: snapshotheader, then count int32 keys, then count int32 counts, host byte order, keys strictly increasing
+ * checksum is a Fletcher style sum over both arrays taken as 32 bit words
+ * save writes <file>.tmp and renames it over <file>, so an interrupted save never leaves a half written snapshot
+ * load maps the file, checks magic, version, size, checksum and key order, then rebuilds with build
+ *********************************************************************************************************************/
+static const char SNAPSHOT_MAGIC[8] = {'B','B','S','T','S','N','A','P'};
+enum {SNAPSHOT_VERSION = 1};
+enum {SNAP_OK, SNAP_NOFILE, SNAP_NOTSNAPSHOT, SNAP_CORRUPT, SNAP_WRITEFAIL};
+
+struct snapshotheader{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;     // 0, reserved for later versions
+    uint64_t count;     // events in snapshot
+    uint64_t checksum;  // snapshotsum over keys then counts
+};
+
+static uint64_t snapshotsum(const int32_t* words, size_t n, uint64_t sum)
+{
+    uint64_t low = sum & 0xffffffffu, high = sum >> 32;
+    for(size_t i = 0 ; i < n; ++i)
+    {
+        low += (uint32_t)words[i];
+        high += low;
+    }
+    return (high << 32) ^ low;
+}
+
+static uint64_t eventsum(const vector<pair<int,int> >& events) // checksum a snapshot of events would carry
+{
+    vector<int32_t> columns(2*events.size()); // keys then counts
+    for(size_t i = 0 ; i < events.size(); ++i)
+    {
+        columns[i] = events[i].first;
+        columns[events.size() + i] = events[i].second;
+    }
+    return snapshotsum(columns.data(), columns.size(), 0);
+}
+
+static int savesnapshot(eventcounter* counter, const char* path, size_t& count, uint64_t& checksum)
+{
+    vector<pair<int,int> > events;
+    counter->exporttree(events);
+    count = events.size();
+    vector<int32_t> columns(2*count); // keys then counts
+    for(size_t i = 0 ; i < count; ++i)
+    {
+        columns[i] = events[i].first;
+        columns[count + i] = events[i].second;
+    }
+    snapshotheader header;
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.flags = 0;
+    header.count = count;
+    header.checksum = checksum = snapshotsum(columns.data(), columns.size(), 0);
+    string temp = string(path) + ".tmp";
+    FILE* file = fopen(temp.c_str(), "wb");
+    if(file == NULL)
+        return SNAP_WRITEFAIL;
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1
+                   && fwrite(columns.data(), sizeof(int32_t), columns.size(), file) == columns.size()
+                   && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    written = fclose(file) == 0 && written;
+    if(!written || rename(temp.c_str(), path) != 0)
+    {
+        unlink(temp.c_str());
+        return SNAP_WRITEFAIL;
+    }
+    return SNAP_OK;
+}
+
+static int loadsnapshot(const char* path, vector<pair<int,int> >& treevec, uint64_t* checksum = NULL)
+{
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return SNAP_NOFILE;
+    struct stat st;
+    int status = fstat(fd, &st) < 0 ? SNAP_NOFILE : (size_t)st.st_size < sizeof(snapshotheader) ? SNAP_NOTSNAPSHOT : SNAP_OK;
+    if(status != SNAP_OK)
+    {
+        close(fd);
+        return status;
+    }
+    size_t size = st.st_size;
+    const char* data = (const char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED)
+        return SNAP_NOFILE;
+    madvise((void*)data, size, MADV_SEQUENTIAL);
+    snapshotheader header;
+    memcpy(&header, data, sizeof(header));
+    if(memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) || header.version != SNAPSHOT_VERSION)
+        status = SNAP_NOTSNAPSHOT;
+    else if(header.count > (size - sizeof(header)) / (2*sizeof(int32_t))
+            || size != sizeof(header) + header.count*2*sizeof(int32_t))
+        status = SNAP_CORRUPT;
+    else
+    {
+        size_t count = header.count;
+        const int32_t* keys = (const int32_t*)(data + sizeof(header));
+        const int32_t* counts = keys + count;
+        if(snapshotsum(keys, 2*count, 0) != header.checksum)
+            status = SNAP_CORRUPT;
+        for(size_t i = 0 ; i < count && status == SNAP_OK; ++i)
+            if((i && keys[i-1] >= keys[i]) || counts[i] <= 0)
+                status = SNAP_CORRUPT;
+        if(status == SNAP_OK)
+        {
+            if(checksum) *checksum = header.checksum;
+            treevec.resize(count);
+            for(size_t i = 0 ; i < count; ++i)
+                treevec[i] = make_pair(keys[i], counts[i]);
+        }
+    }
+    munmap((void*)data, size);
+    return status;
+}
+/*********************************************************************************************************************
+ * writeaheadlog: append only log of increase/reduce and tick, replayed on top of the input file at startup
+ * file: walheader, then one walrecord per mutation; check covers the record and its position, so replay stops at
+ * a torn or stale tail and the file is cut back to the last good record
+ * base ties the log to the state it continues from, walbase of the snapshot checksum (eventsum for a text input
+ * file), so a log is never replayed on top of other input;
+ * save and load reset the log to the new snapshot (checkpoint), so records are never applied twice
+ * sync policy:
+ *   SYNC_ALWAYS: every append is written and fdatasync'ed before append returns
+ *   SYNC_GROUP:  appends are buffered, a flusher thread writes and fdatasyncs them in one go as soon as a commit
+ *                waits, the buffer holds syncbytes or the oldest record is syncus old; commit(lsn) waits for it
+ *   SYNC_NEVER:  appends are written when the buffer holds syncbytes, no fdatasync, commit returns at once
+ *********************************************************************************************************************/
+enum {SYNC_ALWAYS, SYNC_GROUP, SYNC_NEVER};
+enum {WAL_OK, WAL_NOFILE, WAL_NOTWAL, WAL_OTHERBASE};
+static const char WAL_MAGIC[8] = {'B','B','S','T','W','A','L','1'};
+
+struct walheader{
+    char magic[8];
+    uint64_t base;
+};
+
+enum {WAL_STAMP = 16}; // time of the BIN_INCREASE record that follows (increaseat), stored as BIN_TICK stores it
+
+struct walrecord{
+    int32_t op;     // BIN_INCREASE, BIN_REDUCE, BIN_TICK or WAL_STAMP (key high, value low 32 bits of the time)
+    int32_t key;
+    int32_t value;
+    uint32_t check;
+};
+
+static inline uint64_t walbase(uint64_t checksum){return checksum | 1;} // never 0
+
+static uint32_t walcheck(const walrecord& rec, uint64_t lsn)
+{
+    uint64_t h = lsn * 0x9e3779b97f4a7c15ull;
+    h ^= (uint32_t)rec.op + ((uint64_t)(uint32_t)rec.key << 8) + ((uint64_t)(uint32_t)rec.value << 32);
+    h *= 0xff51afd7ed558ccdull;
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+class writeaheadlog{
+    int fd;
+    int policy;
+    size_t syncbytes;
+    long syncus;
+    mutex lock;
+    condition_variable wake;      // flusher: records pending, commit waiting or stopping
+    condition_variable synced;    // committers: durable advanced
+    vector<char> pending;
+    chrono::steady_clock::time_point oldest; // append time of pending[0]
+    uint64_t appended;            // lsn of last appended record, lsns grow from 1 and survive reset
+    uint64_t durable;             // lsn of last record on disk (fdatasync'ed unless SYNC_NEVER)
+    uint64_t start;               // lsn before the first record of the file, check uses the position lsn - start
+    int waiters;
+    bool flushing;                // flusher writes a batch outside the lock
+    bool stopping;
+    thread flusher;
+    void flushloop();
+    void writeout(const vector<char>& data);
+    void syncout();
+public:
+    writeaheadlog(int policy, size_t syncbytes, long syncus);
+    ~writeaheadlog();
+    int open(const char* path, uint64_t base, eventcounter* replayinto, uint64_t& replayed);
+    uint64_t append(int op, int key, int value);
+    void commit(uint64_t lsn);
+    void reset(uint64_t base);
+};
+
+writeaheadlog::writeaheadlog(int policy, size_t syncbytes, long syncus):fd(-1),policy(policy),syncbytes(syncbytes)
+    ,syncus(syncus),appended(0),durable(0),start(0),waiters(0),flushing(false),stopping(false)
+{
+    if(policy == SYNC_GROUP)
+        flusher = thread(&writeaheadlog::flushloop, this);
+}
+
+writeaheadlog::~writeaheadlog()
+{
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    if(flusher.joinable()) flusher.join();
+    if(fd >= 0)
+    {
+        writeout(pending);
+        if(policy != SYNC_NEVER) syncout();
+        close(fd);
+    }
+}
+
+void writeaheadlog::writeout(const vector<char>& data)
+{
+    for(size_t done = 0 ; done < data.size(); )
+    {
+        ssize_t n = write(fd, data.data() + done, data.size() - done);
+        if(n <= 0)
+        {
+            perror("wal write");
+            exit(1); // results must not be acknowledged without their log records
+        }
+        done += n;
+    }
+}
+
+void writeaheadlog::syncout()
+{
+    if(fdatasync(fd) < 0)
+    {
+        perror("wal sync");
+        exit(1); // records written but maybe not on disk must not be acknowledged either
+    }
+}
+/*********************************************************************************************************************
+ * open: replay the log into replayinto when it continues from base, start a new one when the file does not exist
+ * or is shorter than a header
+ *********************************************************************************************************************/
+int writeaheadlog::open(const char* path, uint64_t base, eventcounter* replayinto, uint64_t& replayed)
+{
+    replayed = 0;
+    appended = durable = start = 0;
+    fd = ::open(path, O_RDWR | O_CREAT, 0644);
+    if(fd < 0)
+        return WAL_NOFILE;
+    walheader header;
+    ssize_t got = read(fd, &header, sizeof(header));
+    if(got >= 0 && got < (ssize_t)sizeof(header)) // new file, or a crash cut it while reset wrote the header
+    {
+        reset(base);
+        return WAL_OK;
+    }
+    if(got < 0 || memcmp(header.magic, WAL_MAGIC, sizeof(header.magic)))
+        return WAL_NOTWAL;
+    if(header.base != base)
+        return WAL_OTHERBASE;
+    vector<walrecord> records(4096);
+    off_t good = sizeof(header);
+    bool stamped = false; // last record was a WAL_STAMP
+    long long stamp = 0;
+    for(bool torn = false; !torn; )
+    {
+        got = read(fd, records.data(), records.size()*sizeof(walrecord));
+        size_t n = got > 0 ? got / sizeof(walrecord) : 0;
+        torn = n < records.size();
+        for(size_t i = 0 ; i < n; ++i)
+        {
+            const walrecord& rec = records[i];
+            if(rec.check != walcheck(rec, replayed + 1)
+               || (rec.op != BIN_INCREASE && rec.op != BIN_REDUCE && rec.op != BIN_TICK && rec.op != WAL_STAMP))
+            {
+                torn = true; // stale or half written record, everything after it is dropped
+                break;
+            }
+            long long when = (long long)((uint64_t)(uint32_t)rec.key << 32 | (uint32_t)rec.value);
+            if(rec.op == BIN_INCREASE && stamped)
+                replayinto->increaseat(rec.key, rec.value, stamp);
+            else if(rec.op == BIN_INCREASE)
+                replayinto->increase(rec.key, rec.value);
+            else if(rec.op == BIN_REDUCE)
+                replayinto->decrease(rec.key, rec.value);
+            else if(rec.op == BIN_TICK)
+                replayinto->tick(when);
+            stamped = rec.op == WAL_STAMP;
+            stamp = when;
+            replayed++;
+            good += sizeof(walrecord);
+        }
+    }
+    if(stamped) // the increase of a trailing stamp never made it, drop the stamp too
+    {
+        replayed--;
+        good -= sizeof(walrecord);
+    }
+    if(ftruncate(fd, good) < 0 || lseek(fd, good, SEEK_SET) < 0) // drop a torn tail
+        return WAL_NOFILE;
+    appended = durable = replayed; // start stays 0: new records continue the positions of the replayed ones
+    return WAL_OK;
+}
+/*********************************************************************************************************************
+ * reset: empty the log and start it from base, pending records are dropped, they are part of the new base
+ *********************************************************************************************************************/
+void writeaheadlog::reset(uint64_t base)
+{
+    unique_lock<mutex> guard(lock);
+    while(flushing)
+        synced.wait(guard);
+    pending.clear();
+    walheader header;
+    memcpy(header.magic, WAL_MAGIC, sizeof(header.magic));
+    header.base = base;
+    vector<char> data((char*)&header, (char*)&header + sizeof(header));
+    if(ftruncate(fd, 0) < 0 || lseek(fd, 0, SEEK_SET) < 0)
+        perror("wal reset");
+    writeout(data);
+    if(policy != SYNC_NEVER) syncout();
+    start = durable = appended; // records up to here are part of the new base
+    synced.notify_all();
+}
+
+uint64_t writeaheadlog::append(int op, int key, int value)
+{
+    walrecord rec = {op, key, value, 0};
+    unique_lock<mutex> guard(lock);
+    uint64_t lsn = ++appended;
+    rec.check = walcheck(rec, lsn - start);
+    if(pending.empty()) oldest = chrono::steady_clock::now();
+    pending.insert(pending.end(), (char*)&rec, (char*)&rec + sizeof(rec));
+    if(policy == SYNC_ALWAYS || (policy == SYNC_NEVER && pending.size() >= syncbytes))
+    {
+        writeout(pending);
+        if(policy == SYNC_ALWAYS) syncout();
+        pending.clear();
+        durable = lsn;
+    }
+    else if(policy == SYNC_GROUP && pending.size() >= syncbytes)
+        wake.notify_one();
+    return lsn;
+}
+
+void writeaheadlog::commit(uint64_t lsn)
+{
+    if(policy != SYNC_GROUP)
+        return;
+    unique_lock<mutex> guard(lock);
+    if(durable >= lsn)
+        return;
+    waiters++;
+    wake.notify_one();
+    while(durable < lsn)
+        synced.wait(guard);
+    waiters--;
+}
+
+void writeaheadlog::flushloop()
+{
+    vector<char> batch;
+    unique_lock<mutex> guard(lock);
+    while(!stopping)
+    {
+        if(pending.empty())
+        {
+            wake.wait(guard);
+            continue;
+        }
+        if(!waiters && pending.size() < syncbytes
+           && wake.wait_until(guard, oldest + chrono::microseconds(syncus)) == cv_status::no_timeout)
+            continue; // woken early, check the thresholds again
+        batch.swap(pending);
+        uint64_t lsn = appended;
+        flushing = true;
+        guard.unlock();
+        writeout(batch); // appends go on into pending while this batch is written
+        syncout();
+        batch.clear();
+        guard.lock();
+        flushing = false;
+        durable = max(durable, lsn);
+        synced.notify_all();
+    }
+}
+/*********************************************************************************************************************
+ * walmap: eventcounter that logs every increase/reduce to a writeaheadlog before applying it to the engine
+ * commit is called before results are printed, so a printed result is durable under SYNC_ALWAYS and SYNC_GROUP
+ *********************************************************************************************************************/
+class walmap : public eventcounter{
+    eventcounter* engine;
+    writeaheadlog log;
+    uint64_t last; // lsn of the last logged mutation
+public:
+    walmap(eventcounter* engine, int policy, size_t syncbytes, long syncus)
+        :engine(engine),log(policy, syncbytes, syncus),last(0){}
+    ~walmap(){delete engine;}
+    int open(const char* path, uint64_t base, uint64_t& replayed){return log.open(path, base, engine, replayed);}
+    int build(vector<pair<int,int> >& inp){return engine->build(inp);}
+    int increase(int key, int value)
+    {
+        last = log.append(BIN_INCREASE, key, value);
+        return engine->increase(key, value);
+    }
+    int decrease(int key, int value)
+    {
+        last = log.append(BIN_REDUCE, key, value);
+        return engine->decrease(key, value);
+    }
+    int count(int key){return engine->count(key);}
+    long long inrange(int key1, int key2){return engine->inrange(key1, key2);}
+    bool next(int key, pair<int,int>& found){return engine->next(key, found);}
+    bool previous(int key, pair<int,int>& found){return engine->previous(key, found);}
+    void levelorderprint(){engine->levelorderprint();}
+    void memoryreport(){engine->memoryreport();}
+    void exporttree(vector<pair<int,int> >& out){engine->exporttree(out);}
+    void topk(int k, vector<pair<int,int> >& out){engine->topk(k, out);}
+    bool timed(){return engine->timed();}
+    bool tick(long long now)
+    {
+        if(!engine->tick(now)) return false; // rejected, nothing changed and nothing to replay
+        last = log.append(BIN_TICK, (int32_t)((uint64_t)now >> 32), (int32_t)(uint32_t)now);
+        return true;
+    }
+    int increaseat(int key, int value, long long when)
+    {
+        log.append(WAL_STAMP, (int32_t)((uint64_t)when >> 32), (int32_t)(uint32_t)when);
+        last = log.append(BIN_INCREASE, key, value);
+        return engine->increaseat(key, value, when);
+    }
+    void commit(){log.commit(last);}
+    void checkpoint(uint64_t checksum){log.reset(walbase(checksum));}
+};
+/*********************************************************************************************************************
+ * text command fast path: stdin is read in large blocks, every complete line is tokenized in place
+ * command names are matched by length and lower cased text (commandid), integers by parseint
+ * results and error messages go to an outbuffer that is flushed once per block read
+ * output is the same as parsing every line with stringstream, validate and strequal; the loop ends at
+ * quit or end of input
+ *********************************************************************************************************************/
+enum {CMD_UNKNOWN, CMD_QUIT, CMD_INCREASE, CMD_REDUCE, CMD_COUNT, CMD_INRANGE, CMD_NEXT, CMD_PREVIOUS,
+      CMD_LEVELORDER, CMD_POOLSTATS, CMD_SAVE, CMD_LOAD, CMD_TOPK, CMD_TICK, CMD_STATS};
+
+static inline bool iswhite(char c) // whitespace skipped by operator>> in the C locale
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+static int commandid(const char* word, size_t len)
+{
+    char lower[16];
+    if(len >= sizeof(lower))
+        return CMD_UNKNOWN;
+    for(size_t i = 0 ; i < len; ++i)
+        lower[i] = tolower((unsigned char)word[i]);
+    switch(len)
+    {
+        case 4:
+            if(!memcmp(lower, "quit", 4)) return CMD_QUIT;
+            if(!memcmp(lower, "next", 4)) return CMD_NEXT;
+            if(!memcmp(lower, "save", 4)) return CMD_SAVE;
+            if(!memcmp(lower, "load", 4)) return CMD_LOAD;
+            if(!memcmp(lower, "topk", 4)) return CMD_TOPK;
+            if(!memcmp(lower, "tick", 4)) return CMD_TICK;
+            break;
+        case 5:
+            if(!memcmp(lower, "count", 5)) return CMD_COUNT;
+            if(!memcmp(lower, "stats", 5)) return CMD_STATS;
+            break;
+        case 6:
+            if(!memcmp(lower, "reduce", 6)) return CMD_REDUCE;
+            break;
+        case 7:
+            if(!memcmp(lower, "inrange", 7)) return CMD_INRANGE;
+            break;
+        case 8:
+            if(!memcmp(lower, "increase", 8)) return CMD_INCREASE;
+            if(!memcmp(lower, "previous", 8)) return CMD_PREVIOUS;
+            break;
+        case 9:
+            if(!memcmp(lower, "poolstats", 9)) return CMD_POOLSTATS;
+            break;
+        case 10:
+            if(!memcmp(lower, "levelorder", 10)) return CMD_LEVELORDER;
+            break;
+    }
+    return CMD_UNKNOWN;
+}
+/*********************************************************************************************************************
+ * parseint: same rules as operator>>(Int&): leading whitespace, optional sign, at least one digit, stops at the
+ * first non digit, fails when the value does not fit in Int (int, or long long for times)
+ *********************************************************************************************************************/
+template<class Int>
+static bool parseint(const char*& p, const char* end, Int& value)
+{
+    while(p < end && iswhite(*p)) ++p;
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+    if(p == end || *p < '0' || *p > '9')
+        return false;
+    const unsigned long long limit = (unsigned long long)numeric_limits<Int>::max() + 1; // magnitude of min
+    unsigned long long magnitude = 0;
+    for(; p < end && *p >= '0' && *p <= '9'; ++p) // saturate at limit + 1, still out of range
+        magnitude = magnitude > limit/10 ? limit + 1 : min(magnitude*10 + (*p - '0'), limit + 1);
+    if(magnitude > (negative ? limit : limit - 1))
+        return false;
+    value = negative ? -(Int)(magnitude - 1) - 1 : (Int)magnitude;
+    return true;
+}
+/*********************************************************************************************************************
+ * runsnapshot: save <file> / load <file>, file name is the next token of the line
+ *********************************************************************************************************************/
+static void runsnapshot(eventcounter* counter, bool save, const char* p, const char* end, outbuffer& out)
+{
+    while(p < end && iswhite(*p)) ++p;
+    const char* name = p;
+    while(p < end && !iswhite(*p)) ++p;
+    if(name == p)
+    {
+        out.put("Error ! file name expected\n");
+        return;
+    }
+    string path(name, p);
+    vector<pair<int,int> > treevec;
+    size_t count = 0;
+    uint64_t checksum = 0;
+    int status = save ? savesnapshot(counter, path.c_str(), count, checksum)
+                      : loadsnapshot(path.c_str(), treevec, &checksum);
+    if(status == SNAP_OK && !save)
+    {
+        count = treevec.size();
+        counter->build(treevec);
+    }
+    if(status == SNAP_OK)
+        counter->checkpoint(checksum);
+    switch(status)
+    {
+        case SNAP_OK: out.put(save ? "saved " : "loaded "); out.putint(count); break;
+        case SNAP_NOFILE: out.put("Error ! cannot open snapshot "); out.put(path.c_str()); break;
+        case SNAP_NOTSNAPSHOT: out.put("Error ! not a bbst snapshot "); out.put(path.c_str()); break;
+        case SNAP_CORRUPT: out.put("Error ! snapshot is corrupt "); out.put(path.c_str()); break;
+        default: out.put("Error ! cannot write snapshot "); out.put(path.c_str()); break;
+    }
+    out.put('\n');
+}
+/*********************************************************************************************************************
+ * printstats: stats command, sums the treestats blocks of all threads
+ * per op: count, timed ops, mean ns, p50/p99/p999 as the upper bound of the histogram bucket that holds them, and the
+ * non empty buckets as [low,high) ns count, bucket bounds are powers of two ticks converted to ns
+ *********************************************************************************************************************/
+static void printstats()
+{
+#ifdef BBST_STATS
+    static const char* opnames[STAT_OPS] = {"increase", "reduce", "count", "inrange", "next", "previous"};
+    treestats total = treestats();
+    int threads = 0;
+    {
+        lock_guard<mutex> guard(statsmutex);
+        for(treestats* stats = statslist; stats; stats = stats->nextstats, ++threads)
+        {
+            for(int op = 0 ; op < STAT_OPS; ++op)
+            {
+                total.ops[op] += __atomic_load_n(&stats->ops[op], __ATOMIC_RELAXED);
+                total.latencyticks[op] += __atomic_load_n(&stats->latencyticks[op], __ATOMIC_RELAXED);
+                for(int b = 0 ; b < STAT_BUCKETS; ++b)
+                    total.latency[op][b] += __atomic_load_n(&stats->latency[op][b], __ATOMIC_RELAXED);
+            }
+            total.insertrotations += __atomic_load_n(&stats->insertrotations, __ATOMIC_RELAXED);
+            total.deleterotations += __atomic_load_n(&stats->deleterotations, __ATOMIC_RELAXED);
+            total.searches += __atomic_load_n(&stats->searches, __ATOMIC_RELAXED);
+            total.searchdepth += __atomic_load_n(&stats->searchdepth, __ATOMIC_RELAXED);
+            total.nodes += __atomic_load_n(&stats->nodes, __ATOMIC_RELAXED);
+            total.bytes += __atomic_load_n(&stats->bytes, __ATOMIC_RELAXED);
+        }
+    }
+    double rate = tickspernanosecond();
+    cout<<"threads "<<threads<<endl;
+    const double quantiles[3] = {0.5, 0.99, 0.999};
+    const char* quantilenames[3] = {" p50 < ", " p99 < ", " p999 < "};
+    for(int op = 0 ; op < STAT_OPS; ++op)
+    {
+        unsigned long long timed = 0;
+        for(int b = 0 ; b < STAT_BUCKETS; ++b)
+            timed += total.latency[op][b];
+        cout<<opnames[op]<<" ops "<<total.ops[op]<<" timed "<<timed<<" mean ns "
+            <<(timed ? total.latencyticks[op]/rate/timed : 0);
+        for(int q = 0 ; q < 3 && timed; ++q)
+        {
+            unsigned long long seen = 0;
+            int b = 0;
+            for(; b < STAT_BUCKETS - 1 && (seen += total.latency[op][b]) < quantiles[q]*timed; ++b);
+            cout<<quantilenames[q]<<(long long)ceil((1ULL << (b + 1))/rate);
+        }
+        cout<<endl;
+        for(int b = 0 ; b < STAT_BUCKETS; ++b)
+            if(total.latency[op][b])
+                cout<<"  ["<<(b ? (long long)ceil((1ULL << b)/rate) : 0)<<","<<(long long)ceil((1ULL << (b + 1))/rate)
+                    <<") "<<total.latency[op][b]<<endl;
+    }
+    cout<<"rotations insertFixup "<<total.insertrotations<<" deleteFixup "<<total.deleterotations<<endl;
+    cout<<"searches "<<total.searches<<" average depth "
+        <<(total.searches ? (double)total.searchdepth/total.searches : 0)<<endl;
+    cout<<"nodes "<<total.nodes<<" bytes allocated "<<total.bytes<<endl;
+#else
+    cout<<"stats not compiled in, rebuild with make STATS=1"<<endl;
+#endif
+}
+/*********************************************************************************************************************
+ * runtextline: execute one command line [p, end), returns false on quit
+ *********************************************************************************************************************/
+static bool runtextline(eventcounter* counter, const char* p, const char* end, outbuffer& out)
+{
+    while(p < end && iswhite(*p)) ++p;
+    const char* word = p;
+    while(p < end && !iswhite(*p)) ++p;
+    for(const char* c = word; c < p; ++c) // validate: command is letters only
+    {
+        int lower = tolower((unsigned char)*c);
+        if(lower < 'a' || lower > 'z')
+        {
+            out.put(" Error ! command should be string\n");
+            return true;
+        }
+    }
+    binarycommand cmd = {BIN_QUIT, 0, 0};
+    long long now = 0;
+    switch(commandid(word, p - word))
+    {
+        case CMD_QUIT:
+            return false;
+        case CMD_INCREASE: cmd.op = BIN_INCREASE; break;
+        case CMD_REDUCE: cmd.op = BIN_REDUCE; break;
+        case CMD_COUNT: cmd.op = BIN_COUNT; break;
+        case CMD_INRANGE: cmd.op = BIN_INRANGE; break;
+        case CMD_NEXT: cmd.op = BIN_NEXT; break;
+        case CMD_PREVIOUS: cmd.op = BIN_PREVIOUS; break;
+        case CMD_TOPK: cmd.op = BIN_TOPK; break;
+        case CMD_TICK:
+            if(!parseint(p, end, now))
+                out.put("Error ! Param1 should be a integer value \n");
+            else if(!counter->timed())
+                out.put("Error ! time needs -window\n");
+            else if(!counter->tick(now))
+                out.put("Error ! time is before the clock\n");
+            return true;
+        case CMD_LEVELORDER:
+        case CMD_POOLSTATS:
+        case CMD_STATS:
+            out.flush(); // engine prints through cout
+            if(commandid(word, p - word) == CMD_LEVELORDER)
+                counter->levelorderprint();
+            else if(commandid(word, p - word) == CMD_POOLSTATS)
+                counter->memoryreport();
+            else
+                printstats();
+            cout.flush();
+            return true;
+        case CMD_SAVE:
+        case CMD_LOAD:
+            runsnapshot(counter, commandid(word, p - word) == CMD_SAVE, p, end, out);
+            return true;
+        default:
+            out.put("Error ! Wrong command or command format | enter commands in following format\n");
+            out.put(usagetext);
+            return true;
+    }
+    if(!parseint(p, end, cmd.param1))
+    {
+        out.put("Error ! Param1 should be a integer value \n");
+        return true;
+    }
+    if((cmd.op == BIN_INCREASE || cmd.op == BIN_REDUCE || cmd.op == BIN_INRANGE) && !parseint(p, end, cmd.param2))
+    {
+        out.put(cmd.op == BIN_INRANGE ? "Error !Param 2 should be a integer value \n"
+                                      : "Error ! Param 2 should be a integer value \n");
+        return true;
+    }
+    if(cmd.op == BIN_INCREASE && cmd.param2 > 0 && parseint(p, end, now)) // increase <id> <count> <time>
+    {
+        if(!counter->timed())
+            out.put("Error ! time needs -window\n");
+        else if(now < 0)
+            out.put("Error ! time should not be negative\n");
+        else
+        {
+            out.putint(counter->increaseat(cmd.param1, cmd.param2, now));
+            out.put('\n');
+        }
+        return true;
+    }
+    return runcommand(counter, cmd, out);
+}
+
+static size_t runtext(eventcounter* counter, int fd, FILE* results = stdout)
+{
+    const size_t blocksize = 1 << 20;
+    vector<char> block(blocksize);
+    outbuffer out(results, counter);
+    size_t have = 0, commands = 0;
+    ssize_t got;
+    for(;;)
+    {
+        if(have == block.size()) // line longer than the buffer
+            block.resize(block.size()*2);
+        got = read(fd, &block[0] + have, block.size() - have);
+        if(got <= 0)
+        {
+            if(have) // last line without newline
+            {
+                commands++;
+                runtextline(counter, &block[0], &block[0] + have, out);
+            }
+            return commands;
+        }
+        have += got;
+        const char* begin = &block[0];
+        const char* end = begin + have;
+        const char* line = begin;
+        for(const char* eol; (eol = (const char*)memchr(line, '\n', end - line)) != NULL; line = eol + 1)
+        {
+            commands++;
+            if(!runtextline(counter, line, eol, out))
+                return commands;
+        }
+        have = end - line; // partial line waits for the next read
+        memmove(&block[0], line, have);
+        out.flush();
+    }
+}
+/*********************************************************************************************************************
+ * encodecommands: ./bbst -encode < text_commands > binary_commands, converts text commands to binary records
+ *********************************************************************************************************************/
+static int encodecommands()
+{
+    string line;
+    long long lineno = 0;
+    while(getline(cin, line))
+    {
+        lineno++;
+        stringstream s_command(line);
+        string command;
+        binarycommand cmd = {BIN_QUIT, 0, 0};
+        s_command >> command;
+        if(strequal(command, "increase")) cmd.op = BIN_INCREASE;
+        else if(strequal(command, "reduce")) cmd.op = BIN_REDUCE;
+        else if(strequal(command, "count")) cmd.op = BIN_COUNT;
+        else if(strequal(command, "inrange")) cmd.op = BIN_INRANGE;
+        else if(strequal(command, "next")) cmd.op = BIN_NEXT;
+        else if(strequal(command, "previous")) cmd.op = BIN_PREVIOUS;
+        else if(strequal(command, "topk")) cmd.op = BIN_TOPK;
+        else if(strequal(command, "tick")) cmd.op = BIN_TICK;
+        else if(!strequal(command, "quit"))
+        {
+            cerr<<"skipping line "<<lineno<<": "<<line<<endl;
+            continue;
+        }
+        long long now = 0;
+        if(cmd.op == BIN_TICK)
+            s_command >> now;
+        else
+            s_command >> cmd.param1 >> cmd.param2;
+        if(cmd.op == BIN_TICK || (cmd.op == BIN_INCREASE && s_command >> now)) // increase <id> <count> <time>
+        {
+            binarycommand tick = {BIN_TICK, (int32_t)(uint32_t)now, (int32_t)((uint64_t)now >> 32)};
+            fwrite(&tick, sizeof(tick), 1, stdout);
+        }
+        if(cmd.op != BIN_TICK)
+            fwrite(&cmd, sizeof(cmd), 1, stdout);
+    }
+    return 0;
+}
+/*********************************************************************************************************************
+ * input loader: the input file is mapped with mmap, the body after the nelem line is cut in chunks at newline
+ * boundaries and every chunk is parsed by its own thread; pairs are copied into one vector for build
+ * buildhelper assumes strictly increasing keys, chunks check their own order and the seams are checked
+ * after the join, the first bad or out of order line is reported with its line number
+ *********************************************************************************************************************/
+enum {LOAD_OK, LOAD_NOFILE, LOAD_BADLINE, LOAD_UNSORTED};
+
+struct loadchunk{
+    const char* begin;
+    const char* end;
+    vector<pair<int,int> > pairs;
+    long lines;       // newline terminated lines in chunk
+    long badline;     // 0 based line in chunk, -1 when none
+    long unsorted;
+    size_t offset;    // position of pairs[0] in the merged vector
+};
+
+static void parsechunk(loadchunk& chunk)
+{
+    chunk.lines = 0;
+    chunk.badline = chunk.unsorted = -1;
+    chunk.pairs.reserve((chunk.end - chunk.begin) / 8);
+    for(const char* line = chunk.begin; line < chunk.end; ++chunk.lines)
+    {
+        const char* eol = (const char*)memchr(line, '\n', chunk.end - line);
+        if(eol == NULL) eol = chunk.end;
+        const char* p = line;
+        line = eol + 1;
+        while(p < eol && iswhite(*p)) ++p;
+        if(p == eol)
+            continue; // blank line
+        pair<int,int> kv;
+        if(!parseint(p, eol, kv.first) || !parseint(p, eol, kv.second))
+        {
+            chunk.badline = chunk.lines;
+            return;
+        }
+        if(!chunk.pairs.empty() && chunk.pairs.back().first >= kv.first)
+        {
+            chunk.unsorted = chunk.lines;
+            return;
+        }
+        chunk.pairs.push_back(kv);
+    }
+}
+
+static int loadinput(const char* path, vector<pair<int,int> >& treevec, long& nelem, long& errline)
+{
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return LOAD_NOFILE;
+    struct stat st;
+    if(fstat(fd, &st) < 0)
+    {
+        close(fd);
+        return LOAD_NOFILE;
+    }
+    size_t size = st.st_size;
+    const char* data = size ? (const char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if(data == MAP_FAILED)
+        return LOAD_NOFILE;
+    if(size) madvise((void*)data, size, MADV_SEQUENTIAL);
+    const char* end = data + size;
+    const char* body = size ? (const char*)memchr(data, '\n', size) : NULL;
+    body = body ? body + 1 : end;
+    nelem = strtol(string(data, body).c_str(), NULL, 10);
+
+    size_t nthreads = min<size_t>(max(1u, thread::hardware_concurrency()), (end - body) / (1 << 20) + 1);
+    vector<loadchunk> chunks(nthreads);
+    const char* cut = body;
+    for(size_t i = 0 ; i < nthreads; ++i)
+    {
+        chunks[i].begin = cut;
+        cut = i + 1 == nthreads ? end : max(cut, body + (end - body) * (i + 1) / nthreads);
+        while(cut < end && cut[-1] != '\n') ++cut; // move cut to the start of a line
+        chunks[i].end = cut;
+    }
+    vector<thread> workers;
+    for(size_t i = 1 ; i < nthreads; ++i)
+        workers.push_back(thread(parsechunk, ref(chunks[i])));
+    parsechunk(chunks[0]);
+    for(size_t i = 0 ; i < workers.size(); ++i)
+        workers[i].join();
+
+    int status = LOAD_OK;
+    long line = 2; // line 1 is nelem
+    size_t total = 0;
+    const pair<int,int>* last = NULL;
+    for(size_t i = 0 ; i < nthreads && status == LOAD_OK; ++i)
+    {
+        loadchunk& chunk = chunks[i];
+        if(last && !chunk.pairs.empty() && last->first >= chunk.pairs[0].first)
+        {
+            status = LOAD_UNSORTED; // seam between chunks, report first line of this chunk holding a pair
+            errline = line;
+            for(const char* p = chunk.begin; p < chunk.end && (*p == '\n' || iswhite(*p)); ++p)
+                if(*p == '\n') errline++;
+        }
+        else if(chunk.badline >= 0 || chunk.unsorted >= 0)
+        {
+            status = chunk.badline >= 0 ? LOAD_BADLINE : LOAD_UNSORTED;
+            errline = line + max(chunk.badline, chunk.unsorted);
+        }
+        chunk.offset = total;
+        total += chunk.pairs.size();
+        line += chunk.lines;
+        if(!chunk.pairs.empty()) last = &chunk.pairs.back();
+    }
+    if(size) munmap((void*)data, size);
+    if(status != LOAD_OK)
+        return status;
+    treevec.resize(total);
+    workers.clear();
+    for(size_t i = 1 ; i < nthreads; ++i)
+        workers.push_back(thread([&treevec, &chunks, i]{
+            copy(chunks[i].pairs.begin(), chunks[i].pairs.end(), treevec.begin() + chunks[i].offset);
+        }));
+    copy(chunks[0].pairs.begin(), chunks[0].pairs.end(), treevec.begin());
+    for(size_t i = 0 ; i < workers.size(); ++i)
+        workers[i].join();
+    return LOAD_OK;
+}
+/*********************************************************************************************************************
+ * streamload: the original getline/istringstream loader, kept for the load benchmark
+ *********************************************************************************************************************/
+static void streamload(const char* path, vector<pair<int,int> >& treevec, long& nelem)
+{
+    string temp;
+    ifstream instream;
+    instream.exceptions ( ifstream::failbit | ifstream::badbit );
+    try
+    {
+        instream.open(path);
+        getline(instream,temp);
+        stringstream s_nelem(temp);
+        s_nelem >> nelem;
+        string key, value;
+        int ikey, ivalue;
+        while(getline(instream, key, ' '))
+        {
+            getline(instream, value);
+            istringstream s_key(key);
+            istringstream s_value(value);
+            s_key >> ikey;
+            s_value>> ivalue;
+            treevec.push_back(make_pair(ikey,ivalue));
+        }
+    }
+    catch (ifstream::failure e) {
+    }
+}
+/*********************************************************************************************************************
+ * Benchmarks: ./bbst -bench <name> [params]
+ * inrange [n]: compares node visiting inrange (rangescan) with msum based inrange as range width grows
+ * memory [n]: bytes per event of treemap (pointer layout) and compactmap (index layout) under churn
+ * lookup [n]: count and next latency of treemap, compactmap and bplustree
+ * simd [n]: ns per in node search for every supported nodesearch kernel, then bplustree count/next with each
+ * concurrent [n] [threads] [readpct]: ops/sec of concurrentmap for 1..threads threads, optimistic reads vs mutex
+ * sharded [n] [shards] [clients]: ops/sec of shardedmap on a mixed workload, shard count doubling up to shards
+ * combine [n] [threads] [zipf]: skewed increases through combiningmap vs concurrentmap, results cross checked
+ * batch [n] [ops]: treemap increase/reduce replay one op at a time vs applyBatch with growing batch size
+ * build [n] [threads]: buildtree+colortree against parallelbuild with 1, 2, 4.. threads
+ * wal [ops] [threads]: ops/sec of logged and committed increases for each sync policy and without log
+ * walrestart: for each sync policy, sessions that replay the log, check every earlier record and append more
+ * mvcc [n] [writers] [ops]: write throughput of mvccmap with and without a full scan running, scans checked for
+ *   consistency, concurrentmap with the same scan for comparison
+ * recursion [max n] [queries]: recursive against iterative searchkey and insert at 10^6, 10^7.. up to max n keys
+ * window [n] [buckets]: windowmap increase/count/inrange with 1, 2, 4.. buckets holding n events, and the cost of
+ *   expiring a bucket against deleting its events one by one
+ * static [n]: count/next/inrange of treemap against staticmap (Eytzinger layout, prefix sums), answers cross
+ *   checked, and the cost of the first increase turning staticmap into a treemap
+ * cache [n] [zipf]: count and increase on zipf skewed keys without and with hot key caches of growing size
+ * topk [n] [k]: increase cost without and with the topk index, topk from the index against a full scan
+ * wide [n]: treemap against basic_treemap<int64_t, uint64_t>, node bytes and count/increase/inrange latency, 128 bit
+ *   totals beyond 2^64 and saturating increases checked
+ * workload [n] [uniform|zipf[:s]] [mix] [ops]: generated increase/reduce/count/inrange/next mix (weights
+ *   i:r:c:q:n, default 20:5:50:15:10) on n keys, ops/sec untimed, then p50/p99/p999 per op, peak RSS
+ * replay <input_file> <command_file> [binary]: runs a recorded command file against treemap, results discarded
+ * scan [n]: ns per step of next on random keys, next chained from the last answer and a cursor walk
+ * load [n]: writes an n pair input file, then times streamload (getline) against loadinput (mmap, parallel)
+ *********************************************************************************************************************/
+static double elapsedns(chrono::steady_clock::time_point start, long long ops)
+{
+    chrono::duration<double, nano> spent = chrono::steady_clock::now() - start;
+    return ops ? spent.count() / ops : 0;
+}
+
+static int benchinrange(int n)
+{
+    treemap mytree;
+    vector<pair<int,int> > treevec;
+    for(int i = 0 ; i < n; ++i)
+        treevec.push_back(make_pair(2*i, i%100 + 1)); // even keys so that ranges also start on missing keys
+    mytree.build(treevec);
+    mt19937 gen(42);
+    const int queries = 2000;
+    cout<<"keys "<<n<<" queries per width "<<queries<<endl;
+    cout<<"width\tscan ns/op\tinrange ns/op"<<endl;
+    for(long long width = 1; width <= 2LL*n; width *= 10)
+    {
+        vector<pair<int,int> > ranges;
+        uniform_int_distribution<long long> pick(0, max(0LL, 2LL*n - width));
+        for(int i = 0 ; i < queries; ++i)
+        {
+            int key1 = pick(gen);
+            ranges.push_back(make_pair(key1, (int)(key1 + width - 1)));
+        }
+        long long check = 0, total = 0;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int i = 0 ; i < queries; ++i)
+            check += mytree.rangescan(ranges[i].first, ranges[i].second);
+        double scanns = elapsedns(start, queries);
+        start = chrono::steady_clock::now();
+        for(int i = 0 ; i < queries; ++i)
+            total += mytree.inrange(ranges[i].first, ranges[i].second);
+        double sumns = elapsedns(start, queries);
+        if(check != total)
+        {
+            cout<<"Error ! inrange mismatch at width "<<width<<endl;
+            return 1;
+        }
+        cout<<width<<"\t"<<scanns<<"\t"<<sumns<<endl;
+    }
+    return 0;
+}
+
+static int benchmemory(int n)
+{
+    treemap rbtree;
+    compactmap compact;
+    eventcounter* counters[2] = {&rbtree, &compact};
+    vector<pair<int,int> > treevec;
+    for(int i = 0 ; i < n; ++i)
+        treevec.push_back(make_pair(2*i, i%100 + 1));
+    for(int c = 0 ; c < 2; ++c)
+    {
+        counters[c]->build(treevec);
+        mt19937 gen(7);
+        uniform_int_distribution<int> pick(0, 4*n);
+        for(int i = 0 ; i < n; ++i) // churn: insert new ids and remove existing ones
+        {
+            counters[c]->increase(pick(gen), 5);
+            counters[c]->decrease(pick(gen), 1000);
+        }
+        cout<<(c ? "compactmap" : "treemap")<<endl;
+        counters[c]->memoryreport();
+    }
+    return 0;
+}
+
+static int benchlookup(int n)
+{
+    treemap rbtree;
+    compactmap compact;
+    bplustree btree;
+    eventcounter* counters[3] = {&rbtree, &compact, &btree};
+    const char* names[3] = {"treemap", "compactmap", "bplustree"};
+    vector<pair<int,int> > treevec;
+    for(int i = 0 ; i < n; ++i)
+        treevec.push_back(make_pair(2*i, i%100 + 1));
+    const int queries = 1000000;
+    vector<int> keys(queries);
+    mt19937 gen(11);
+    uniform_int_distribution<int> pick(0, 2*n);
+    for(int i = 0 ; i < queries; ++i)
+        keys[i] = pick(gen);
+    cout<<"keys "<<n<<" queries "<<queries<<endl;
+    cout<<"engine\tcount ns/op\tnext ns/op"<<endl;
+    for(int c = 0 ; c < 3; ++c)
+    {
+        counters[c]->build(treevec);
+        long long check = 0;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int i = 0 ; i < queries; ++i)
+            check += counters[c]->count(keys[i]);
+        double countns = elapsedns(start, queries);
+        pair<int,int> found;
+        start = chrono::steady_clock::now();
+        for(int i = 0 ; i < queries; ++i)
+            if(counters[c]->next(keys[i], found)) check += found.second;
+        double nextns = elapsedns(start, queries);
+        cout<<names[c]<<"\t"<<countns<<"\t"<<nextns<<"\t(check "<<check<<")"<<endl;
+    }
+    return 0;
+}
+
+static int benchsimd(int n)
+{
+    const int nodes = 4096; // 256KB of keys, hot in cache
+    const int lookups = 4000000;
+    vector<int> keys(nodes*NODEKEYS);
+    vector<int> sizes(nodes);
+    vector<int> probes(lookups);
+    mt19937 gen(5);
+    uniform_int_distribution<int> pick(-1000, 1000);
+    for(int i = 0 ; i < nodes; ++i)
+    {
+        sizes[i] = 1 + gen() % NODEKEYS;
+        for(int j = 0 ; j < NODEKEYS; ++j)
+            keys[i*NODEKEYS + j] = pick(gen);
+        sort(keys.begin() + i*NODEKEYS, keys.begin() + i*NODEKEYS + sizes[i]);
+    }
+    for(int i = 0 ; i < lookups; ++i)
+        probes[i] = pick(gen);
+    const nodesearch* best = selectkernel();
+    cout<<"selected kernel "<<best->name<<endl;
+    cout<<"kernel\tupper ns/lookup\tlower ns/lookup"<<endl;
+    long long reference = -1;
+    for(int k = 0 ; k < nsearchkernels; ++k)
+    {
+        const nodesearch* search = &searchkernels[k];
+        if(k > best - searchkernels) break; // not supported by this cpu
+        long long check = 0;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int i = 0 ; i < lookups; ++i)
+        {
+            int node = i & (nodes - 1);
+            check += search->upper(&keys[node*NODEKEYS], sizes[node], probes[i]);
+        }
+        double upperns = elapsedns(start, lookups);
+        start = chrono::steady_clock::now();
+        for(int i = 0 ; i < lookups; ++i)
+        {
+            int node = i & (nodes - 1);
+            check += search->lower(&keys[node*NODEKEYS], sizes[node], probes[i]);
+        }
+        double lowerns = elapsedns(start, lookups);
+        if(reference >= 0 && check != reference)
+        {
+            cout<<"Error ! kernel "<<search->name<<" mismatch"<<endl;
+            return 1;
+        }
+        reference = check;
+        cout<<search->name<<"\t"<<upperns<<"\t"<<lowerns<<endl;
+    }
+    bplustree btree;
+    vector<pair<int,int> > treevec;
+    for(int i = 0 ; i < n; ++i)
+        treevec.push_back(make_pair(2*i, i%100 + 1));
+    btree.build(treevec);
+    uniform_int_distribution<int> pickkey(0, 2*n);
+    for(int i = 0 ; i < lookups; ++i)
+        probes[i] = pickkey(gen);
+    cout<<"bplustree keys "<<n<<endl<<"kernel\tcount ns/op\tnext ns/op"<<endl;
+    for(int k = 0 ; k <= best - searchkernels; ++k)
+    {
+        bplustree::setkernel(&searchkernels[k]);
+        long long check = 0;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int i = 0 ; i < lookups; ++i)
+            check += btree.count(probes[i]);
+        double countns = elapsedns(start, lookups);
+        pair<int,int> found;
+        start = chrono::steady_clock::now();
+        for(int i = 0 ; i < lookups; ++i)
+            if(btree.next(probes[i], found)) check += found.first;
+        double nextns = elapsedns(start, lookups);
+        cout<<searchkernels[k].name<<"\t"<<countns<<"\t"<<nextns<<"\t(check "<<check<<")"<<endl;
+    }
+    bplustree::setkernel(best);
+    return 0;
+}
+
+/*********************************************************************************************************************
+ * concurrent benchmark: every thread runs readpct% reads (count/inrange/next in turn) and the rest increase/reduce
+ * on uniform keys for a fixed time, concurrentmap with optimistic reads is compared against readers taking the lock
+ *********************************************************************************************************************/
+static void concurrentworker(eventcounter* counter, int n, int readpct, unsigned seed, atomic<bool>* stop,
+                             long long* ops, long long* checks)
+{
+    mt19937 gen(seed);
+    uniform_int_distribution<int> pickkey(0, 2*n);
+    uniform_int_distribution<int> pickop(0, 99);
+    pair<int,int> found;
+    long long done = 0, check = 0;
+    while(!stop->load(memory_order_relaxed))
+    {
+        int key = pickkey(gen);
+        if(pickop(gen) < readpct)
+        {
+            switch(done % 3)
+            {
+                case 0: check += counter->count(key); break;
+                case 1: check += counter->inrange(key, key + 100); break;
+                default: if(counter->next(key, found)) check += found.second;
+            }
+        }
+        else if(done & 1)
+            counter->increase(key, 3);
+        else
+            counter->decrease(key, 2);
+        done++;
+    }
+    *ops = done;
+    *checks = check; // keeps reads from being optimized away
+}
+
+static int benchconcurrent(int n, int maxthreads, int readpct)
+{
+    vector<pair<int,int> > treevec;
+    for(int i = 0 ; i < n; ++i)
+        treevec.push_back(make_pair(2*i, i%100 + 1));
+    cout<<"keys "<<n<<" reads "<<readpct<<"%"<<endl;
+    cout<<"threads\tmutex ops/s\toptimistic ops/s\tretries\tfallbacks"<<endl;
+    for(int threads = 1 ; threads <= maxthreads; ++threads)
+    {
+        double opspersec[2];
+        unsigned long retries = 0, fallbacks = 0;
+        for(int mode = 0 ; mode < 2; ++mode)
+        {
+            concurrentmap counter(mode == 1);
+            counter.build(treevec);
+            atomic<bool> stop(false);
+            vector<long long> ops(threads), checks(threads);
+            vector<thread> workers;
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            for(int t = 0 ; t < threads; ++t)
+                workers.push_back(thread(concurrentworker, &counter, n, readpct, 100 + t, &stop, &ops[t], &checks[t]));
+            this_thread::sleep_for(chrono::milliseconds(500));
+            stop = true;
+            for(int t = 0 ; t < threads; ++t)
+                workers[t].join();
+            chrono::duration<double> spent = chrono::steady_clock::now() - start;
+            long long total = 0;
+            for(int t = 0 ; t < threads; ++t)
+                total += ops[t];
+            opspersec[mode] = total / spent.count();
+            retries = counter.readretries();
+            fallbacks = counter.readfallbacks();
+        }
+        cout<<threads<<"\t"<<(long long)opspersec[0]<<"\t"<<(long long)opspersec[1]<<"\t"<<retries<<"\t"<<fallbacks<<endl;
+    }
+    return 0;
+}
+
+/*********************************************************************************************************************
+ * sharded benchmark: clients threads run a mixed workload (40% increase/reduce, 45% count, 10% inrange, 5% next)
+ * against shardedmap with 1..maxshards shards
+ *********************************************************************************************************************/
+static void shardclient(eventcounter* counter, int n, unsigned seed, int ops, long long* checks)
+{
+    mt19937 gen(seed);
+    uniform_int_distribution<int> pickkey(0, 2*n);
+    uniform_int_distribution<int> pickop(0, 99);
+    pair<int,int> found;
+    long long check = 0;
+    for(int i = 0 ; i < ops; ++i)
+    {
+        int key = pickkey(gen), op = pickop(gen);
+        if(op < 20) counter->increase(key, 3);
+        else if(op < 40) counter->decrease(key, 2);
+        else if(op < 85) check += counter->count(key);
+        else if(op < 95) check += counter->inrange(key, key + 1000);
+        else if(counter->next(key, found)) check += found.second;
+    }
+    *checks = check;
+}
+
+static int benchsharded(int n, int maxshards, int clients)
+{
+    vector<pair<int,int> > treevec;
+    for(int i = 0 ; i < n; ++i)
+        treevec.push_back(make_pair(2*i, i%100 + 1));
+    const int ops = 200000;
+    cout<<"keys "<<n<<" client threads "<<clients<<" ops per client "<<ops<<endl;
+    cout<<"shards\tops/s"<<endl;
+    for(int nshards = 1 ; nshards <= maxshards; nshards *= 2)
+    {
+        shardedmap counter(nshards);
+        counter.build(treevec);
+        vector<long long> checks(clients);
+        vector<thread> threads;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int t = 0 ; t < clients; ++t)
+            threads.push_back(thread(shardclient, &counter, n, 200 + t, ops, &checks[t]));
+        for(int t = 0 ; t < clients; ++t)
+            threads[t].join();
+        chrono::duration<double> spent = chrono::steady_clock::now() - start;
+        cout<<nshards<<"\t"<<(long long)(clients*(double)ops/spent.count())<<endl;
+    }
+    return 0;
+}
+
+/*********************************************************************************************************************
+ * zipfgen: zipf distributed ranks in [0, n), rank 0 is the hottest, inverse cdf by binary search
+ *********************************************************************************************************************/
+class zipfgen{
+    vector<double> cdf;
+public:
+    zipfgen(int n, double s):cdf(n){
+        double total = 0;
+        for(int i = 0 ; i < n; ++i)
+            cdf[i] = total += 1.0/pow(i + 1.0, s);
+        for(int i = 0 ; i < n; ++i)
+            cdf[i] /= total;
+    }
+    template<class Gen> int operator()(Gen& gen)
+    {
+        double u = uniform_real_distribution<double>(0, 1)(gen);
+        return min<size_t>(lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin(), cdf.size() - 1);
+    }
+};
+/*********************************************************************************************************************
+ * combine benchmark: threads add zipf skewed increases through combiningmap and through concurrentmap,
+ * then totals and sample counts of both maps are compared
+ *********************************************************************************************************************/
+static void combineworker(eventcounter* counter, combiningmap* combining, const vector<int>* keys)
+{
+    for(size_t i = 0 ; i < keys->size(); ++i)
+    {
+        if(combining) combining->add((*keys)[i], 1 + (i & 3));
+        else counter->increase((*keys)[i], 1 + (i & 3));
+    }
+}
+
+static int benchcombine(int n, int threads, double skew)
+{
+    const int ops = 1000000;
+    vector<pair<int,int> > treevec;
+    for(int i = 0 ; i < n; ++i)
+        treevec.push_back(make_pair(2*i, 1));
+    zipfgen zipf(n, skew);
+    concurrentmap direct;
+    combiningmap combining;
+    direct.build(treevec);
+    combining.build(treevec);
+    vector<vector<int> > keys(threads, vector<int>(ops)); // drawn up front, sampling is slower than a buffered add
+    for(int t = 0 ; t < threads; ++t)
+    {
+        mt19937 gen(300 + t);
+        for(int i = 0 ; i < ops; ++i)
+            keys[t][i] = 2*zipf(gen);
+    }
+    cout<<"keys "<<n<<" threads "<<threads<<" zipf "<<skew<<" increases per thread "<<ops<<endl;
+    for(int mode = 0 ; mode < 2; ++mode)
+    {
+        vector<thread> workers;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int t = 0 ; t < threads; ++t)
+            workers.push_back(thread(combineworker, &direct, mode ? &combining : NULL, &keys[t]));
+        for(int t = 0 ; t < threads; ++t)
+            workers[t].join();
+        long long total = mode ? combining.inrange(INT_MIN, INT_MAX) : direct.inrange(INT_MIN, INT_MAX);
+        chrono::duration<double> spent = chrono::steady_clock::now() - start;
+        cout<<(mode ? "combining" : "immediate")<<"\tops/s "<<(long long)(threads*(double)ops/spent.count())<<"\ttotal "<<total<<endl;
+    }
+    for(int key = 0 ; key < 2*n; key += 2)
+        if(direct.count(key) != combining.count(key))
+        {
+            cout<<"Error ! count mismatch for "<<key<<endl;
+            return 1;
+        }
+    combining.memoryreport();
+    return 0;
+}
+
+/*********************************************************************************************************************
+ * batch benchmark: same random increase/reduce replay applied one op at a time and with applyBatch per chunk
+ *********************************************************************************************************************/
+static int benchbatch(int n, int ops)
+{
+    vector<pair<int,int> > treevec;
+    for(int i = 0 ; i < n; ++i)
+        treevec.push_back(make_pair(2*i, i%100 + 1));
+    vector<batchop> replay(ops);
+    mt19937 gen(17);
+    uniform_int_distribution<int> pickkey(0, 3*n);
+    for(int i = 0 ; i < ops; ++i)
+    {
+        replay[i].type = gen() % 2 ? batchop::INCREASE : batchop::REDUCE;
+        replay[i].key = pickkey(gen);
+        replay[i].value = 1 + gen() % 60;
+    }
+    treemap single;
+    single.build(treevec);
+    vector<int> expected(ops);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(int i = 0 ; i < ops; ++i)
+        expected[i] = replay[i].type == batchop::INCREASE ? single.increase(replay[i].key, replay[i].value)
+                                                          : single.decrease(replay[i].key, replay[i].value);
+    cout<<"keys "<<n<<" ops "<<ops<<endl;
+    cout<<"batch size\tns/op"<<endl<<"per op\t"<<elapsedns(start, ops)<<endl;
+    for(int chunk = 1000 ; chunk <= ops; chunk *= 10)
+    {
+        treemap batched;
+        batched.build(treevec);
+        vector<batchop> pending;
+        start = chrono::steady_clock::now();
+        for(int i = 0 ; i < ops; i += chunk)
+        {
+            pending.assign(replay.begin() + i, replay.begin() + min(ops, i + chunk));
+            batched.applyBatch(pending);
+            for(size_t j = 0 ; j < pending.size(); ++j)
+                replay[i+j].result = pending[j].result;
+        }
+        double ns = elapsedns(start, ops);
+        for(int i = 0 ; i < ops; ++i)
+            if(replay[i].result != expected[i])
+            {
+                cout<<"Error ! batch result mismatch at op "<<i<<endl;
+                return 1;
+            }
+        if(batched.inrange(INT_MIN, INT_MAX) != single.inrange(INT_MIN, INT_MAX) || batched.size() != single.size())
+        {
+            cout<<"Error ! batch final tree mismatch"<<endl;
+            return 1;
+        }
+        cout<<chunk<<"\t"<<ns<<endl;
+    }
+    return 0;
+}
+
+static int benchload(int n)
+{
+    char path[] = "/tmp/bbstloadXXXXXX";
+    int fd = mkstemp(path);
+    if(fd < 0)
+    {
+        cout<<"Error ! cannot create temporary input file"<<endl;
+        return 1;
+    }
+    FILE* file = fdopen(fd, "w");
+    {
+        outbuffer out(file);
+        out.putint(n);
+        out.put('\n');
+        for(int i = 0 ; i < n; ++i)
+        {
+            out.putint(3LL*i);
+            out.put(' ');
+            out.putint(i%100 + 1);
+            out.put('\n');
+        }
+    }
+    fclose(file);
+    vector<pair<int,int> > streamed, mapped;
+    long nelem = 0, errline = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    streamload(path, streamed, nelem);
+    double streamns = elapsedns(start, n);
+    start = chrono::steady_clock::now();
+    int status = loadinput(path, mapped, nelem, errline);
+    double mappedns = elapsedns(start, n);
+    unlink(path);
+    if(status != LOAD_OK || streamed != mapped)
+    {
+        cout<<"Error ! loaders disagree"<<endl;
+        return 1;
+    }
+    cout<<"pairs "<<n<<" threads "<<thread::hardware_concurrency()<<endl;
+    cout<<"loader\tns/pair"<<endl<<"getline\t"<<streamns<<endl<<"mmap\t"<<mappedns<<endl;
+    return 0;
+}
+static int benchbuild(int n, int maxthreads)
+{
+    vector<pair<int,int> > treevec(n);
+    for(int i = 0 ; i < n; ++i)
+        treevec[i] = make_pair(2*i, i%100 + 1);
+    long long total = 0;
+    {
+        treemap serial;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        serial.colortree(serial.buildtree(treevec));
+        cout<<"keys "<<n<<endl<<"build\tns/key"<<endl<<"buildtree+colortree\t"<<elapsedns(start, n)<<endl;
+        total = serial.inrange(INT_MIN, INT_MAX);
+    }
+    for(int threads = 1 ; threads <= max(1, maxthreads); threads *= 2)
+    {
+        treemap tree;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        tree.parallelbuild(treevec, threads);
+        double ns = elapsedns(start, n);
+        if(tree.inrange(INT_MIN, INT_MAX) != total)
+        {
+            cout<<"Error ! parallelbuild sum mismatch"<<endl;
+            return 1;
+        }
+        cout<<"parallelbuild "<<threads<<" threads\t"<<ns<<endl;
+    }
+    return 0;
+}
+static int benchwal(int ops, int threads)
+{
+    vector<pair<int,int> > treevec;
+    for(int i = 0 ; i < 100000; ++i)
+        treevec.push_back(make_pair(2*i, 1));
+    const char* names[] = {"always", "group", "never", "no wal"};
+    cout<<"threads "<<threads<<", every op is an increase committed before the next one"<<endl;
+    cout<<"sync\tops\tops/sec"<<endl;
+    for(int policy = SYNC_ALWAYS; policy <= SYNC_NEVER + 1; ++policy)
+    {
+        int n = policy == SYNC_ALWAYS ? min(ops, 20000) : ops; // one fdatasync per op
+        char path[] = "/tmp/bbstwalXXXXXX";
+        int fd = mkstemp(path);
+        if(fd < 0)
+        {
+            cout<<"Error ! cannot create temporary wal"<<endl;
+            return 1;
+        }
+        close(fd);
+        unlink(path);
+        concurrentmap counter;
+        counter.build(treevec);
+        uint64_t replayed = 0;
+        writeaheadlog* log = policy <= SYNC_NEVER ? new writeaheadlog(policy, 1 << 20, 2000) : NULL;
+        if(log && log->open(path, 0, &counter, replayed) != WAL_OK)
+        {
+            cout<<"Error ! cannot open wal "<<path<<endl;
+            return 1;
+        }
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        vector<thread> workers;
+        for(int t = 0 ; t < threads; ++t)
+            workers.push_back(thread([&counter, log, n, threads, t]{
+                mt19937 gen(t);
+                for(int i = t ; i < n; i += threads)
+                {
+                    int key = 2*(gen() % 100000);
+                    if(log) log->commit(log->append(BIN_INCREASE, key, 1));
+                    counter.increase(key, 1);
+                }
+            }));
+        for(int t = 0 ; t < threads; ++t)
+            workers[t].join();
+        double ns = elapsedns(start, n);
+        delete log;
+        unlink(path);
+        cout<<names[policy]<<"\t"<<n<<"\t"<<(ns ? 1e9/ns : 0)<<endl;
+    }
+    return 0;
+}
+/*********************************************************************************************************************
+ * walrestart: session s replays the log, every increase of sessions 0..s-1 must be back (count of id 100 + i is
+ * i + 1), then appends its own; a session also checkpoints with reset once, the log restarts from that base
+ * the first session finds a header cut short by a crash and must start a new log
+ *********************************************************************************************************************/
+static int benchwalrestart()
+{
+    const char* names[] = {"always", "group", "never"};
+    const int sessions = 4, perrun = 3;
+    for(int policy = SYNC_ALWAYS; policy <= SYNC_NEVER; ++policy)
+    {
+        char path[] = "/tmp/bbstwalXXXXXX";
+        int fd = mkstemp(path);
+        if(fd < 0)
+        {
+            cout<<"Error ! cannot create temporary wal"<<endl;
+            return 1;
+        }
+        bool torn = write(fd, WAL_MAGIC, 5) == 5; // header write cut by a crash
+        close(fd);
+        if(!torn)
+        {
+            cout<<"Error ! cannot write temporary wal"<<endl;
+            unlink(path);
+            return 1;
+        }
+        vector<pair<int,int> > base; // state the log continues from, grows at the checkpoint
+        uint64_t basetag = 0;
+        int first = 0;               // first id in the log
+        for(int s = 0 ; s <= sessions; ++s)
+        {
+            treemap counter;
+            counter.build(base);
+            uint64_t replayed = 0;
+            writeaheadlog* log = new writeaheadlog(policy, 1 << 20, 2000);
+            bool ok = log->open(path, basetag, &counter, replayed) == WAL_OK
+                      && replayed == (uint64_t)(s*perrun - first);
+            for(int i = 0 ; i < s*perrun && ok; ++i)
+                ok = counter.count(100 + i) == i + 1;
+            if(!ok)
+            {
+                cout<<"Error ! "<<names[policy]<<" session "<<s<<" replayed "<<replayed<<" of "<<s*perrun - first
+                    <<" records"<<endl;
+                delete log;
+                unlink(path);
+                return 1;
+            }
+            if(s == 2) // checkpoint: the replayed state becomes the base, the log starts over
+            {
+                base.clear();
+                counter.exporttree(base);
+                basetag = walbase(s);
+                log->reset(basetag);
+                first = s*perrun;
+            }
+            for(int i = s*perrun ; i < (s + 1)*perrun && s < sessions; ++i)
+            {
+                log->commit(log->append(BIN_INCREASE, 100 + i, i + 1));
+                counter.increase(100 + i, i + 1);
+            }
+            delete log;
+        }
+        unlink(path);
+        cout<<names[policy]<<"\t"<<sessions*perrun<<" records kept over "<<sessions<<" restarts"<<endl;
+    }
+    return 0;
+}
+/*********************************************************************************************************************
+ * mvcc: writers run increase/reduce pairs while one thread repeatedly exports the whole map and checks the export
+ * against inrange over all keys; a scan is consistent when both see the same version
+ *********************************************************************************************************************/
+template<class Map, class Scan>
+static void mvccround(const char* name, Map& counter, int n, int ops, int writers, bool scanning, Scan scan)
+{
+    atomic<bool> done(false);
+    atomic<long> scans(0), torn(0);
+    thread scanner;
+    if(scanning)
+        scanner = thread([&]{
+            vector<pair<int,int> > events;
+            while(!done.load())
+            {
+                events.clear();
+                long long exported = 0, total = scan(events);
+                for(size_t i = 0 ; i < events.size(); ++i)
+                    exported += events[i].second;
+                if(exported != total) torn++;
+                scans++;
+            }
+        });
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for(int t = 0 ; t < writers; ++t)
+        workers.push_back(thread([&counter, n, ops, writers, t]{
+            mt19937 gen(t);
+            for(int i = t ; i < ops; i += 2*writers)
+            {
+                int key = 2*(gen() % n);
+                counter.increase(key, 1);
+                counter.decrease(key, 1);
+            }
+        }));
+    for(int t = 0 ; t < writers; ++t)
+        workers[t].join();
+    double ns = elapsedns(start, ops);
+    done = true;
+    if(scanning) scanner.join();
+    cout<<name<<"\t"<<(scanning ? "yes" : "no")<<"\t"<<(ns ? 1e9/ns : 0)<<"\t"<<scans.load()<<"\t"<<torn.load()<<endl;
+}
+
+static int benchmvcc(int n, int writers, int ops)
+{
+    vector<pair<int,int> > treevec;
+    for(int i = 0 ; i < n; ++i)
+        treevec.push_back(make_pair(2*i, i%100 + 1));
+    cout<<"keys "<<n<<" writers "<<writers<<" ops "<<ops<<endl;
+    cout<<"engine\tscan\twrites/sec\tscans\tinconsistent scans"<<endl;
+    for(int scanning = 0 ; scanning < 2; ++scanning)
+    {
+        mvccmap versioned;
+        versioned.build(treevec);
+        mvccround("mvccmap", versioned, n, ops, writers, scanning, [&versioned](vector<pair<int,int> >& out){
+            mvccmap::snapshot view = versioned.opensnapshot();
+            view.exporttree(out);
+            return view.inrange(INT_MIN, INT_MAX);
+        });
+    }
+    concurrentmap locked;
+    locked.build(treevec);
+    mvccround("concurrentmap", locked, n, ops, writers, true, [&locked](vector<pair<int,int> >& out){
+        locked.exporttree(out); // no common version: every next() is its own read
+        return locked.inrange(INT_MIN, INT_MAX);
+    });
+    return 0;
+}
+static int benchscan(int n)
+{
+    vector<pair<int,int> > treevec;
+    for(int i = 0 ; i < n; ++i)
+        treevec.push_back(make_pair(2*i, i%100 + 1));
+    treemap tree;
+    tree.build(treevec);
+    mt19937 gen(3);
+    vector<int> keys(n);
+    for(int i = 0 ; i < n; ++i)
+        keys[i] = gen() % (2*n);
+    long long check[3] = {0, 0, 0};
+    pair<int,int> found;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(int i = 0 ; i < n; ++i)
+        if(tree.next(keys[i], found)) check[0] += found.second;
+    double randomns = elapsedns(start, n);
+    start = chrono::steady_clock::now();
+    for(int key = INT_MIN; tree.next(key, found); key = found.first) // next of the last answer: one link each
+        check[1] += found.second;
+    double chainns = elapsedns(start, n);
+    start = chrono::steady_clock::now();
+    for(treemap::cursor walk = tree.seek(INT_MIN); walk.valid(); walk.next())
+        check[2] += walk.value();
+    double cursorns = elapsedns(start, n);
+    if(check[1] != check[2] || check[2] != tree.inrange(INT_MIN, INT_MAX))
+    {
+        cout<<"Error ! scan sums differ"<<endl;
+        return 1;
+    }
+    cout<<"keys "<<n<<" (checksum "<<check[0]<<")"<<endl;
+    cout<<"walk\tns/step"<<endl<<"next random key\t"<<randomns<<endl<<"next chained\t"<<chainns<<endl
+        <<"cursor\t"<<cursorns<<endl;
+    return 0;
+}
+static int benchrecursion(int maxkeys, int queries)
+{
+    cout<<"queries "<<queries<<" (count on random present/absent keys, increase inserting new keys)"<<endl;
+    cout<<"keys\tcount recursive\tcount iterative\tinsert recursive\tinsert iterative\t(ns/op)"<<endl;
+    for(long long n = 1000000 ; n <= maxkeys; n *= 10)
+    {
+        vector<pair<int,int> > treevec(n);
+        for(int i = 0 ; i < n; ++i)
+            treevec[i] = make_pair(2*i, 1);
+        mt19937 gen(11);
+        vector<int> keys(queries), fresh(queries);
+        for(int i = 0 ; i < queries; ++i)
+        {
+            keys[i] = gen() % (2*n);
+            fresh[i] = 2*(gen() % n) + 1; // odd: absent
+        }
+        double ns[4];
+        long long check[2] = {0, 0};
+        for(int iterative = 0 ; iterative < 2; ++iterative)
+        {
+            treemap tree;
+            tree.build(treevec);
+            RBNode* top = tree.getroot();
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            for(int i = 0 ; i < queries; ++i)
+            {
+                RBNode* found = iterative ? tree.searchkey(top, keys[i]) : tree.searchkeyrecursive(top, keys[i]);
+                if(found) check[iterative] += found->mvalue;
+            }
+            ns[iterative] = elapsedns(start, queries);
+            start = chrono::steady_clock::now();
+            for(int i = 0 ; i < queries; ++i)
+                if(!tree.searchkey(tree.getroot(), fresh[i])) // increase of an absent key
+                {
+                    if(iterative) tree.insert(fresh[i], 1);
+                    else tree.insertrecursive(fresh[i], 1);
+                }
+            ns[2 + iterative] = elapsedns(start, queries);
+            check[iterative] += tree.inrange(INT_MIN, INT_MAX);
+        }
+        if(check[0] != check[1])
+        {
+            cout<<"Error ! recursive and iterative results differ"<<endl;
+            return 1;
+        }
+        cout<<n<<"\t"<<ns[0]<<"\t"<<ns[1]<<"\t"<<ns[2]<<"\t"<<ns[3]<<endl;
+    }
+    return 0;
+}
+static int benchwindow(int n, int maxbuckets)
+{
+    int queries = 200000;
+    mt19937 gen(21);
+    vector<int> keys(n);
+    for(int i = 0 ; i < n; ++i)
+        keys[i] = gen() % (4*n);
+    cout<<"events "<<n<<" queries "<<queries<<" (ns/op, increase includes its tick, expire: ns per event of the oldest"
+        <<" bucket)"<<endl;
+    cout<<"buckets\tincrease\tcount\tinrange\texpire\tdelete one by one"<<endl;
+    for(int nbuckets = 1 ; nbuckets <= maxbuckets; nbuckets *= 2)
+    {
+        windowmap window(nbuckets, nbuckets); // 1 second buckets, event time from 0
+        window.tick(0);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int i = 0 ; i < n; ++i)
+        {
+            window.tick((long long)i*nbuckets/n); // stamped increase: events spread evenly over the ring
+            window.increase(keys[i], 1);
+        }
+        double increasens = elapsedns(start, n);
+        long long check = 0;
+        start = chrono::steady_clock::now();
+        for(int i = 0 ; i < queries; ++i)
+            check += window.count(keys[i % n]);
+        double countns = elapsedns(start, queries);
+        start = chrono::steady_clock::now();
+        for(int i = 0 ; i < queries; ++i)
+            check += window.inrange(keys[i % n], keys[i % n] + 1000);
+        double inrangens = elapsedns(start, queries);
+        long long before = window.inrange(INT_MIN, INT_MAX);
+        int oldest = 0;
+        for(int i = 0 ; i < n && (long long)i*nbuckets/n == 0; ++i)
+            oldest++;
+        start = chrono::steady_clock::now();
+        window.tick(nbuckets); // the bucket of time 0 leaves the window
+        double expirens = elapsedns(start, oldest);
+        if(before - window.inrange(INT_MIN, INT_MAX) != oldest || check == 0)
+        {
+            cout<<"Error ! expired bucket did not hold the oldest events"<<endl;
+            return 1;
+        }
+        treemap single;
+        for(int i = 0 ; i < oldest; ++i)
+            single.increase(keys[i], 1);
+        start = chrono::steady_clock::now();
+        for(int i = 0 ; i < oldest; ++i)
+            single.decrease(keys[i], 1);
+        double deletens = elapsedns(start, oldest);
+        cout<<nbuckets<<"\t"<<increasens<<"\t"<<countns<<"\t"<<inrangens<<"\t"<<expirens<<"\t"<<deletens<<endl;
+    }
+    return 0;
+}
+static int benchstatic(int n)
+{
+    treemap rbtree;
+    staticmap eytzinger;
+    eventcounter* counters[2] = {&rbtree, &eytzinger};
+    const char* names[2] = {"treemap", "staticmap"};
+    vector<pair<int,int> > treevec;
+    for(int i = 0 ; i < n; ++i)
+        treevec.push_back(make_pair(2*i, i%100 + 1));
+    const int queries = 1000000;
+    vector<int> keys(queries), widths(queries);
+    mt19937 gen(23);
+    uniform_int_distribution<int> pick(0, 2*n), width(0, 2000);
+    for(int i = 0 ; i < queries; ++i)
+    {
+        keys[i] = pick(gen);
+        widths[i] = width(gen);
+    }
+    cout<<"keys "<<n<<" queries "<<queries<<" (ns/op, inrange over up to 1000 keys)"<<endl;
+    cout<<"engine\tcount\tnext\tinrange"<<endl;
+    long long check[2];
+    for(int c = 0 ; c < 2; ++c)
+    {
+        counters[c]->build(treevec);
+        check[c] = 0;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int i = 0 ; i < queries; ++i)
+            check[c] += counters[c]->count(keys[i]);
+        double countns = elapsedns(start, queries);
+        pair<int,int> found;
+        start = chrono::steady_clock::now();
+        for(int i = 0 ; i < queries; ++i)
+            if(counters[c]->next(keys[i], found)) check[c] += found.first + found.second;
+        double nextns = elapsedns(start, queries);
+        start = chrono::steady_clock::now();
+        for(int i = 0 ; i < queries; ++i)
+            check[c] += counters[c]->inrange(keys[i], keys[i] + widths[i]);
+        double inrangens = elapsedns(start, queries);
+        cout<<names[c]<<"\t"<<countns<<"\t"<<nextns<<"\t"<<inrangens<<endl;
+    }
+    if(check[0] != check[1])
+    {
+        cout<<"Error ! treemap and staticmap answers differ"<<endl;
+        return 1;
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    eytzinger.increase(1, 1);
+    cout<<"first increase (thaw into treemap) ms "<<elapsedns(start, 1)/1e6<<endl;
+    return 0;
+}
+
+static int benchcache(int n, double skew)
+{
+    int ops = 1000000;
+    vector<pair<int,int> > treevec(n);
+    for(int i = 0 ; i < n; ++i)
+        treevec[i] = make_pair(2*i, 1);
+    zipfgen zipf(n, skew);
+    mt19937 gen(22);
+    vector<int> keys(ops);
+    for(int i = 0 ; i < ops; ++i)
+        keys[i] = 2*((zipf(gen)*7919LL) % n); // scatter hot ranks over the key space
+    cout<<"keys "<<n<<" zipf "<<skew<<" ops "<<ops<<" (ns/op)"<<endl;
+    cout<<"cache slots\tcount\tincrease\thit rate"<<endl;
+    long long check[2] = {0, 0};
+    for(size_t slots = 0 ; slots <= (1 << 18); slots = slots ? slots*16 : 1024)
+    {
+        treemap tree;
+        tree.build(treevec);
+        tree.setcache(slots);
+        long long total = 0;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int i = 0 ; i < ops; ++i)
+            total += tree.count(keys[i]);
+        double countns = elapsedns(start, ops);
+        start = chrono::steady_clock::now();
+        for(int i = 0 ; i < ops; ++i)
+            tree.increase(keys[i], 1);
+        double increasens = elapsedns(start, ops);
+        total += tree.inrange(INT_MIN, INT_MAX);
+        if(slots && total != check[0])
+        {
+            cout<<"Error ! cached and uncached results differ"<<endl;
+            return 1;
+        }
+        check[0] = total;
+        cout<<slots<<"\t"<<countns<<"\t"<<increasens<<"\t"<<tree.cachehitrate()<<endl;
+    }
+    return 0;
+}
+static int benchtopk(int n, int k)
+{
+    int ops = 1000000, queries = 100;
+    vector<pair<int,int> > treevec(n);
+    mt19937 gen(20);
+    for(int i = 0 ; i < n; ++i)
+        treevec[i] = make_pair(2*i, gen() % 1000 + 1);
+    vector<int> keys(ops);
+    for(int i = 0 ; i < ops; ++i)
+        keys[i] = 2*(gen() % n);
+    treemap tree;
+    tree.build(treevec);
+    double increasens[2];
+    for(int indexed = 0 ; indexed < 2; ++indexed)
+    {
+        vector<pair<int,int> > first;
+        if(indexed) tree.topk(1, first); // creates the index
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int i = 0 ; i < ops; ++i)
+            tree.increase(keys[i], 1);
+        increasens[indexed] = elapsedns(start, ops);
+    }
+    vector<pair<int,int> > indexed, scanned;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(int i = 0 ; i < queries; ++i)
+    {
+        indexed.clear();
+        tree.topk(k, indexed);
+    }
+    double indexns = elapsedns(start, queries);
+    start = chrono::steady_clock::now();
+    for(int i = 0 ; i < queries; ++i)
+    {
+        scanned.clear();
+        tree.eventcounter::topk(k, scanned); // exporttree and partial_sort
+    }
+    double scanns = elapsedns(start, queries);
+    if(indexed != scanned)
+    {
+        cout<<"Error ! topk index and full scan differ"<<endl;
+        return 1;
+    }
+    cout<<"keys "<<n<<" k "<<k<<endl;
+    cout<<"increase ns/op\twithout index "<<increasens[0]<<"\twith index "<<increasens[1]<<endl;
+    cout<<"topk ns/query\tindex "<<indexns<<"\tfull scan "<<scanns<<endl;
+    return 0;
+}
+/*********************************************************************************************************************
+ * workload: ops are generated up front as binarycommand records so key drawing stays out of the timings
+ * keys are 2*rank, zipf ranks are scattered over the key space like benchcache, inrange spans 100 keys
+ *********************************************************************************************************************/
+enum {MIX_OPS = 5};
+static const char* mixnames[MIX_OPS] = {"increase", "reduce", "count", "inrange", "next"};
+static const int mixops[MIX_OPS] = {BIN_INCREASE, BIN_REDUCE, BIN_COUNT, BIN_INRANGE, BIN_NEXT};
+
+static inline long long applyop(eventcounter* counter, const binarycommand& cmd)
+{
+    pair<int,int> found;
+    switch(cmd.op)
+    {
+        case BIN_INCREASE: return counter->increase(cmd.param1, cmd.param2);
+        case BIN_REDUCE: return counter->decrease(cmd.param1, cmd.param2);
+        case BIN_COUNT: return counter->count(cmd.param1);
+        case BIN_INRANGE: return counter->inrange(cmd.param1, cmd.param2);
+        default: return counter->next(cmd.param1, found) ? found.second : 0;
+    }
+}
+
+static long peakrsskb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss; // kilobytes on linux
+}
+
+static double percentile(vector<float>& ns, double q)
+{
+    if(ns.empty()) return 0;
+    size_t at = min(ns.size() - 1, (size_t)(q*ns.size()));
+    nth_element(ns.begin(), ns.begin() + at, ns.end());
+    return ns[at];
+}
+
+static int benchworkload(int n, const string& dist, const string& mix, int ops)
+{
+    int weight[MIX_OPS];
+    double skew = 0;
+    if(dist == "zipf")
+        skew = 1.1;
+    else if(dist.compare(0, 5, "zipf:") == 0)
+        skew = atof(dist.c_str() + 5);
+    if(n <= 0 || ops <= 0 || (dist != "uniform" && skew <= 0)
+       || sscanf(mix.c_str(), "%d:%d:%d:%d:%d", &weight[0], &weight[1], &weight[2], &weight[3], &weight[4]) != MIX_OPS)
+    {
+        cout<<"usage: ./bbst -bench workload [nkeys] [uniform|zipf[:exponent]] [i:r:c:q:n weights] [ops]"<<endl;
+        return 1;
+    }
+    int totalweight = 0;
+    for(int i = 0 ; i < MIX_OPS; ++i)
+        totalweight += max(weight[i], 0);
+    if(totalweight == 0)
+    {
+        cout<<"Error ! op mix has no positive weight"<<endl;
+        return 1;
+    }
+    vector<pair<int,int> > treevec(n);
+    for(int i = 0 ; i < n; ++i)
+        treevec[i] = make_pair(2*i, i%100 + 1);
+    mt19937 gen(24);
+    zipfgen* zipf = skew > 0 ? new zipfgen(n, skew) : NULL;
+    vector<binarycommand> script(ops);
+    for(int i = 0 ; i < ops; ++i)
+    {
+        int pick = gen() % totalweight, op = 0;
+        while(pick >= max(weight[op], 0))
+            pick -= max(weight[op++], 0);
+        int rank = zipf ? (int)(((*zipf)(gen)*7919LL) % n) : (int)(gen() % n);
+        script[i].op = mixops[op];
+        script[i].param1 = 2*rank;
+        script[i].param2 = mixops[op] == BIN_INRANGE ? 2*rank + 200 : 1 + gen() % 4;
+    }
+    delete zipf;
+    cout<<"keys "<<n<<" "<<dist<<" mix i:r:c:q:n "<<mix<<" ops "<<ops<<endl;
+    long long check = 0;
+    treemap* tree = new treemap();
+    tree->build(treevec);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(int i = 0 ; i < ops; ++i)
+        check += applyop(tree, script[i]);
+    double throughputns = elapsedns(start, ops);
+    delete tree;
+    // second run on a fresh tree, every op timed on its own
+    tree = new treemap();
+    tree->build(treevec);
+    vector<float> latency[MIX_OPS];
+    for(int i = 0 ; i < MIX_OPS; ++i)
+        latency[i].reserve((long long)ops*max(weight[i], 0)/totalweight + 1);
+    for(int i = 0 ; i < ops; ++i)
+    {
+        int op = find(mixops, mixops + MIX_OPS, script[i].op) - mixops;
+        start = chrono::steady_clock::now();
+        check -= applyop(tree, script[i]);
+        latency[op].push_back(elapsedns(start, 1));
+    }
+    delete tree;
+    if(check != 0)
+    {
+        cout<<"Error ! timed and untimed runs differ"<<endl;
+        return 1;
+    }
+    cout<<"all ops/sec "<<(long long)(1e9/throughputns)<<endl;
+    cout<<"op	ops	ops/sec	p50 ns	p99 ns	p999 ns"<<endl;
+    for(int i = 0 ; i < MIX_OPS; ++i)
+    {
+        if(latency[i].empty()) continue;
+        double total = 0;
+        for(size_t j = 0 ; j < latency[i].size(); ++j)
+            total += latency[i][j];
+        cout<<mixnames[i]<<"\t"<<latency[i].size()<<"\t"<<(long long)(1e9*latency[i].size()/total)<<"\t"
+            <<percentile(latency[i], 0.5)<<"\t"<<percentile(latency[i], 0.99)<<"\t"<<percentile(latency[i], 0.999)<<endl;
+    }
+    cout<<"peak rss kb "<<peakrsskb()<<endl;
+    return 0;
+}
+/*********************************************************************************************************************
+ * replay: the input file is built into a treemap and the command file (text, or binary records from -encode)
+ * is run through runtext/runbinary with results written to /dev/null; levelorder/poolstats go to a muted cout
+ *********************************************************************************************************************/
+static int benchreplay(const char* inputfile, const char* commandfile, bool binary)
+{
+    vector<pair<int,int> > treevec;
+    long nelem = 0, errline = 0;
+    if(loadinput(inputfile, treevec, nelem, errline) != LOAD_OK)
+    {
+        cout<<"Error ! cannot load input file "<<inputfile<<endl;
+        return 1;
+    }
+    int fd = open(commandfile, O_RDONLY);
+    FILE* devnull = fopen("/dev/null", "w");
+    if(fd < 0 || devnull == NULL)
+    {
+        cout<<"Exception opening/reading file ! Wrong file name\n";
+        if(fd >= 0) close(fd);
+        if(devnull) fclose(devnull);
+        return 1;
+    }
+    treemap tree;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    tree.build(treevec);
+    double buildns = elapsedns(start, 1);
+    streambuf* console = cout.rdbuf(NULL);
+    start = chrono::steady_clock::now();
+    size_t commands = binary ? runbinary(&tree, fd, devnull) : runtext(&tree, fd, devnull);
+    double ns = elapsedns(start, commands);
+    cout.rdbuf(console);
+    cout.clear();
+    close(fd);
+    fclose(devnull);
+    cout<<"events "<<treevec.size()<<" build ms "<<buildns/1e6<<endl;
+    cout<<"commands "<<commands<<" ns/command "<<ns<<" commands/sec "<<(long long)(ns ? 1e9/ns : 0)<<endl;
+    cout<<"peak rss kb "<<peakrsskb()<<endl;
+    return 0;
+}
+/*********************************************************************************************************************
+ * sumtext: decimal text of a 128 bit sum, ostream has no operator for it
+ *********************************************************************************************************************/
+static string sumtext(unsigned __int128 sum)
+{
+    string text;
+    do
+    {
+        text.insert(text.begin(), char('0' + (int)(sum % 10)));
+        sum /= 10;
+    }while(sum);
+    return text;
+}
+
+template<class Key, class Count>
+static void benchwidelayout(const char* name, vector<pair<Key,Count> >& treevec, vector<Key>& keys, Key span)
+{
+    basic_treemap<Key,Count> tree;
+    tree.build(treevec);
+    int queries = keys.size();
+    typename countsum<Count>::type check = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(int i = 0 ; i < queries; ++i)
+        check += tree.count(keys[i]);
+    double countns = elapsedns(start, queries);
+    start = chrono::steady_clock::now();
+    for(int i = 0 ; i < queries; ++i)
+        tree.increase(keys[i], 1);
+    double increasens = elapsedns(start, queries);
+    start = chrono::steady_clock::now();
+    for(int i = 0 ; i < queries; ++i)
+        check += tree.inrange(keys[i], keys[i] + span);
+    double inrangens = elapsedns(start, queries);
+    cout<<name<<"\t"<<sizeof(typename basic_treemap<Key,Count>::RBNode)<<"\t"<<countns<<"\t"<<increasens
+        <<"\t"<<inrangens<<"\t"<<sumtext(check)<<endl;
+}
+
+static int benchwide(int n)
+{
+    int queries = 1000000;
+    vector<pair<int,int> > narrow(n);
+    vector<pair<int64_t,uint64_t> > wide(n);
+    const int64_t stride = (int64_t)1 << 33; // wide keys beyond the int range
+    const uint64_t big = (uint64_t)1 << 62;
+    for(int i = 0 ; i < n; ++i)
+    {
+        narrow[i] = make_pair(2*i, i%100 + 1);
+        wide[i] = make_pair((int64_t)(i - n/2)*stride, big + i%100);
+    }
+    mt19937 gen(19);
+    vector<int> narrowkeys(queries);
+    vector<int64_t> widekeys(queries);
+    for(int i = 0 ; i < queries; ++i)
+    {
+        int pos = gen() % n;
+        narrowkeys[i] = 2*pos + gen() % 2; // odd: absent
+        widekeys[i] = (int64_t)(pos - n/2)*stride + (gen() % 2)*(stride/2);
+    }
+    cout<<"keys "<<n<<" queries "<<queries<<" (ns/op, inrange over 1000 keys)"<<endl;
+    cout<<"layout\tnode bytes\tcount\tincrease\tinrange\tchecksum"<<endl;
+    benchwidelayout<int,int>("int/int", narrow, narrowkeys, 2000);
+    benchwidelayout<int64_t,uint64_t>("int64/uint64", wide, widekeys, 1000*stride);
+    // totals above 2^64 are exact, increases stop at the largest count instead of wrapping
+    basic_treemap<int64_t,uint64_t> tree;
+    tree.build(wide);
+    unsigned __int128 expected = 0;
+    for(int i = 0 ; i < n; ++i)
+        expected += wide[i].second;
+    unsigned __int128 total = tree.inrange(INT64_MIN, INT64_MAX);
+    uint64_t first = tree.count(wide[0].first);
+    uint64_t saturated = tree.increase(wide[0].first, UINT64_MAX);
+    expected += UINT64_MAX - first;
+    treemap narrowtree;
+    narrowtree.build(narrow);
+    long long narrowtotal = narrowtree.inrange(INT_MIN, INT_MAX) - narrowtree.count(0) + INT_MAX;
+    if(total != expected - (UINT64_MAX - first) || saturated != UINT64_MAX || tree.inrange(INT64_MIN, INT64_MAX) != expected
+       || narrowtree.increase(0, INT_MAX) != INT_MAX || narrowtree.inrange(INT_MIN, INT_MAX) != narrowtotal)
+    {
+        cout<<"Error ! wide totals or saturated counts differ from expected"<<endl;
+        return 1;
+    }
+    cout<<"int64/uint64 total "<<sumtext(total)<<", after saturating increase "<<sumtext(expected)<<endl;
+    return 0;
+}
+static int runbenchmark(int argc, char* argv[])
+{
+    string name = argc > 2 ? argv[2] : "";
+    int n = argc > 3 ? atoi(argv[3]) : 1000000;
+    if(name == "inrange")
+        return benchinrange(n);
+    if(name == "memory")
+        return benchmemory(n);
+    if(name == "lookup")
+        return benchlookup(n);
+    if(name == "simd")
+        return benchsimd(n);
+    if(name == "mvcc")
+        return benchmvcc(n, argc > 4 ? atoi(argv[4]) : 2, argc > 5 ? atoi(argv[5]) : 2000000);
+    if(name == "walrestart")
+        return benchwalrestart();
+    if(name == "wal")
+        return benchwal(n, argc > 4 ? atoi(argv[4]) : 8);
+    if(name == "build")
+        return benchbuild(n, argc > 4 ? atoi(argv[4]) : thread::hardware_concurrency());
+    if(name == "load")
+        return benchload(n);
+    if(name == "scan")
+        return benchscan(n);
+    if(name == "wide")
+        return benchwide(n);
+    if(name == "window")
+        return benchwindow(n, argc > 4 ? atoi(argv[4]) : 16);
+    if(name == "static")
+        return benchstatic(n);
+    if(name == "workload")
+        return benchworkload(n, argc > 4 ? argv[4] : "uniform", argc > 5 ? argv[5] : "20:5:50:15:10",
+                             argc > 6 ? atoi(argv[6]) : 1000000);
+    if(name == "replay" && argc > 4)
+        return benchreplay(argv[3], argv[4], argc > 5 && string(argv[5]) == "binary");
+    if(name == "cache")
+        return benchcache(n, argc > 4 ? atof(argv[4]) : 1.1);
+    if(name == "topk")
+        return benchtopk(n, argc > 4 ? atoi(argv[4]) : 10);
+    if(name == "recursion")
+        return benchrecursion(argc > 3 ? n : 10000000, argc > 4 ? atoi(argv[4]) : 1000000);
+    if(name == "batch")
+        return benchbatch(n, argc > 4 ? atoi(argv[4]) : 1000000);
+    if(name == "combine")
+        return benchcombine(n, argc > 4 ? atoi(argv[4]) : 4, argc > 5 ? atof(argv[5]) : 1.1);
+    if(name == "sharded")
+        return benchsharded(n, argc > 4 ? atoi(argv[4]) : thread::hardware_concurrency(), argc > 5 ? atoi(argv[5]) : 4);
+    if(name == "concurrent")
+        return benchconcurrent(n, argc > 4 ? atoi(argv[4]) : thread::hardware_concurrency(), argc > 5 ? atoi(argv[5]) : 90);
+    cout<<"usage: ./bbst -bench inrange|memory|lookup|simd|load|scan|wide|static [nkeys]"<<endl;
+    cout<<"       ./bbst -bench concurrent [nkeys] [threads] [read percent]"<<endl;
+    cout<<"       ./bbst -bench sharded [nkeys] [shards] [client threads]"<<endl;
+    cout<<"       ./bbst -bench combine [nkeys] [threads] [zipf exponent]"<<endl;
+    cout<<"       ./bbst -bench batch [nkeys] [ops]"<<endl;
+    cout<<"       ./bbst -bench build [nkeys] [threads]"<<endl;
+    cout<<"       ./bbst -bench wal [ops] [threads]"<<endl;
+    cout<<"       ./bbst -bench walrestart"<<endl;
+    cout<<"       ./bbst -bench mvcc [nkeys] [writers] [ops]"<<endl;
+    cout<<"       ./bbst -bench recursion [max nkeys] [queries]"<<endl;
+    cout<<"       ./bbst -bench topk [nkeys] [k]"<<endl;
+    cout<<"       ./bbst -bench cache [nkeys] [zipf exponent]"<<endl;
+    cout<<"       ./bbst -bench window [nevents] [buckets]"<<endl;
+    cout<<"       ./bbst -bench workload [nkeys] [uniform|zipf[:exponent]] [i:r:c:q:n weights] [ops]"<<endl;
+    cout<<"       ./bbst -bench replay <input_file> <command_file> [binary]"<<endl;
+    return 1;
+}
+
+int main(int argc, char* argv[]){
+    if(argc > 1 && string(argv[1]) == "-bench")
+        return runbenchmark(argc, argv);
+    if(argc > 1 && string(argv[1]) == "-encode")
+        return encodecommands();
+    int argi = 1;
+    bool compactmode = false;
+    bool btreemode = false;
+    bool concurrentmode = false;
+    bool mvccmode = false;
+    int nshards = 0;
+    long long window = 0;
+    int nbuckets = 0;   // 0: the largest divisor of window up to 60
+    long cacheslots = 0;
+    bool staticmode = false;
+    bool binarymode = false;
+    const char* commandfile = NULL;
+    const char* walfile = NULL;
+    int syncpolicy = SYNC_GROUP;
+    long syncus = 2000;
+    size_t syncbytes = 1 << 20;
+    for(; argi < argc && argv[argi][0] == '-'; ++argi)
+    {
+        if(string(argv[argi]) == "-compact")
+            compactmode = true;
+        else if(string(argv[argi]) == "-btree")
+            btreemode = true;
+        else if(string(argv[argi]) == "-concurrent")
+            concurrentmode = true;
+        else if(string(argv[argi]) == "-mvcc")
+            mvccmode = true;
+        else if(string(argv[argi]) == "-shards" && argi + 1 < argc && atoi(argv[argi+1]) > 0)
+            nshards = atoi(argv[++argi]);
+        else if(string(argv[argi]) == "-window" && argi + 1 < argc && atoll(argv[argi+1]) > 0)
+            window = atoll(argv[++argi]);
+        else if(string(argv[argi]) == "-buckets" && argi + 1 < argc && atoi(argv[argi+1]) > 0)
+            nbuckets = atoi(argv[++argi]);
+        else if(string(argv[argi]) == "-cache" && argi + 1 < argc && atol(argv[argi+1]) > 0)
+            cacheslots = atol(argv[++argi]);
+        else if(string(argv[argi]) == "-static")
+            staticmode = true;
+        else if(string(argv[argi]) == "-binary")
+            binarymode = true;
+        else if(string(argv[argi]) == "-commands" && argi + 1 < argc)
+            commandfile = argv[++argi];
+        else if(string(argv[argi]) == "-wal" && argi + 1 < argc)
+            walfile = argv[++argi];
+        else if(string(argv[argi]) == "-sync" && argi + 1 < argc && string(argv[argi+1]) == "always")
+            syncpolicy = SYNC_ALWAYS, ++argi;
+        else if(string(argv[argi]) == "-sync" && argi + 1 < argc && string(argv[argi+1]) == "group")
+            syncpolicy = SYNC_GROUP, ++argi;
+        else if(string(argv[argi]) == "-sync" && argi + 1 < argc && string(argv[argi+1]) == "never")
+            syncpolicy = SYNC_NEVER, ++argi;
+        else if(string(argv[argi]) == "-syncus" && argi + 1 < argc && atol(argv[argi+1]) >= 0)
+            syncus = atol(argv[++argi]);
+        else if(string(argv[argi]) == "-syncbytes" && argi + 1 < argc && atol(argv[argi+1]) > 0)
+            syncbytes = atol(argv[++argi]);
+        else
+            break;
+    }
+    if(argi != argc - 1)
+    {
+        cout<<"usage: ./bbst [-compact|-btree|-concurrent|-mvcc|-static|-shards N|-window S [-buckets N]|-cache N]"<<endl;
+        cout<<"              [-binary [-commands file]]                 (-buckets N must divide -window S)"<<endl;
+        cout<<"              [-wal file [-sync always|group|never] [-syncus N] [-syncbytes N]] <input_file>"<<endl;
+        cout<<"       ./bbst -bench <name> [params] | ./bbst -encode < text_commands > binary_commands"<<endl;
+        return 1;
+    }
+    if(window)
+    {
+        if(!nbuckets)
+            for(nbuckets = min(window, 60LL); window % nbuckets; --nbuckets);
+        if(window % nbuckets) // buckets of S/N seconds would not cover the window exactly
+        {
+            cout<<"Error ! -window "<<window<<" is not a multiple of -buckets "<<nbuckets<<endl;
+            return 1;
+        }
+    }
+    eventcounter* counter = NULL;
+    if(compactmode)
+        counter = new compactmap(); // 32 bit index layout
+    else if(btreemode)
+        counter = new bplustree();
+    else if(concurrentmode)
+        counter = new concurrentmap();
+    else if(mvccmode)
+        counter = new mvccmap();
+    else if(nshards)
+        counter = new shardedmap(nshards);
+    else if(staticmode)
+        counter = new staticmap();
+    else if(window)
+        counter = new windowmap(window, nbuckets);
+    else if(cacheslots)
+    {
+        treemap* cached = new treemap();
+        cached->setcache(cacheslots);
+        counter = cached;
+    }
+    else
+        counter = new treemap();
+    cout<<" input file " << argv[argi]<<endl;
+    {
+        vector<pair<int,int> > treevec;
+        long nelem = 0, errline = 0;
+        uint64_t checksum = 0;
+        int snapshot = loadsnapshot(argv[argi], treevec, &checksum); // restart from a snapshot written by save
+        if(snapshot == SNAP_CORRUPT)
+        {
+            cout<<"Error ! snapshot is corrupt "<<argv[argi]<<endl;
+            delete counter;
+            return 1;
+        }
+        int status = LOAD_OK;
+        if(snapshot == SNAP_OK)
+            nelem = treevec.size();
+        else
+        {
+            status = loadinput(argv[argi], treevec, nelem, errline);
+            checksum = eventsum(treevec); // a wal is tied to the content of a text input file as well
+        }
+        if(status == LOAD_NOFILE)
+            std::cout << "Exception opening/reading file ! Wrong file name\n";
+        else
+            cout<<" nelem "<<nelem<<endl;
+        if(status == LOAD_BADLINE || status == LOAD_UNSORTED)
+        {
+            cout<<"Error ! input line "<<errline<<(status == LOAD_BADLINE ? " should be <id_INT> <count_INT>"
+                  : " id is not greater than the previous id, input must be sorted by id")<<endl;
+            delete counter;
+            return 1;
+        }
+        int maxlevel = counter->build(treevec);
+        cout<<"maxlevel "<< maxlevel<<endl;
+        if(walfile)
+        {
+            walmap* logged = new walmap(counter, syncpolicy, syncbytes, syncus);
+            counter = logged;
+            uint64_t replayed = 0;
+            int walstatus = logged->open(walfile, walbase(checksum), replayed);
+            if(walstatus != WAL_OK)
+            {
+                cout<<(walstatus == WAL_NOFILE ? "Error ! cannot open wal " : walstatus == WAL_NOTWAL
+                       ? "Error ! not a bbst wal " : "Error ! wal does not continue this input file ")<<walfile<<endl;
+                delete counter;
+                return 1;
+            }
+            cout<<" wal "<<walfile<<" replayed "<<replayed<<endl;
+        }
+    }
+    cout<<" Tree built "<<endl;
+    if(binarymode)
+    {
+        int fd = commandfile ? open(commandfile, O_RDONLY) : 0;
+        if(fd < 0)
+            cout<<"Exception opening/reading file ! Wrong file name\n";
+        else
+            runbinary(counter, fd);
+        if(commandfile && fd >= 0) close(fd);
+        delete counter;
+        return 0;
+    }
+    printusage();
+    runtext(counter, 0);
+    delete counter;
+    return 0;
+}